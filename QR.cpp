@@ -1,5 +1,15 @@
 #include "QR.h"
-#include "png/png.h"
+#include "classify.h"
+#include "penalty.h"
+#include "render.h"
+#include "rs.h"
+#include "scheduler.h"
+#include <algorithm>
+#include <atomic>
+#include <limits.h>
+#include <list>
+#include <memory>
+#include <mutex>
 #include <stdlib.h>
 #include <string.h>
 
@@ -16,15 +26,14 @@
 #define FINDER_PATTERN_SIZE      (7)
 /* Alignment pattern size: 5*5 */
 #define ALIGN_PATTERN_SIZE       (5)
-/* Total alphanumeric characters */
-#define ALPHA_NUMERIC_COUNT      (45)
 
-/* Module data:
- * 1. Not set: 0x80 (light only)
- * 2. Function pattern:  0x10 (light); 0x11 (dark)
- * 3. Data pattern DARK: 0x00 (light); 0x01 (dark) */
-#define MODULE_NOT_SET           (0x80)
-#define MODULE_FUNCION_PATTERN   (0x10)
+/* Reference payloads whose parity templates are kept, least recently used ones are dropped */
+#define EC_TEMPLATE_CACHE        (8)
+/* Lowest version whose data masks are scored on several threads
+ * Below it rows fit in one 64-bit word and a candidate scores in ~3 us, less than waking pool threads costs;
+ * from version 15 (77 modules) on it takes 10 ~ 35 us. */
+#define MASK_PARALLEL_VERSION    (15)
+
 
 
 typedef struct
@@ -34,6 +43,31 @@ typedef struct
     int block_data_bytes;
 }EC_INFO;
 
+/* Prebuilt planes of a version */
+class VERSION_TEMPLATE
+{
+public:
+    /* Function pattern modules (format information all light) */
+    BIT_MATRIX dark;
+    /* Function pattern and reserved (format and version information) area */
+    BIT_MATRIX function;
+    /* Modules flipped by each data mask */
+    BIT_MATRIX mask[8];
+    /* Plane bit offset of each codeword bit, in placement order */
+    vector<unsigned short> placement;
+};
+
+/* Parity templates of a reference payload (QR_OPTIONS::ec_template) */
+class EC_TEMPLATE
+{
+public:
+    string reference;
+    bool mixed_mode;
+    std::once_flag built[QR_MAX_VERSION][QR_EC_LEVEL];
+    /* One per block, empty if the reference does not fit in the version */
+    vector<RS_TEMPLATE> blocks[QR_MAX_VERSION][QR_EC_LEVEL];
+};
+
 typedef struct
 {
     int total_bytes;
@@ -287,86 +321,6 @@ static const QR_INFO QR_info[] =
     }
 };
 
-/* GF(2^8): Galois field
- * Prime modulus polynomical, P(α) = α^8+α^4+α^3+α^2+1 = 0;
- * => α^8 = α^4+α^3+α^2+1 = 29 (00011101)
- */
-
-/* Y = GF_INT[X]: Y = α^X */
-static const unsigned char GF_INT[256] =
-{
-      1,   2,   4,   8,  16,  32,  64, 128,  29,  58, 116, 232, 205, 135,  19,  38,
-     76, 152,  45,  90, 180, 117, 234, 201, 143,   3,   6,  12,  24,  48,  96, 192,
-    157,  39,  78, 156,  37,  74, 148,  53, 106, 212, 181, 119, 238, 193, 159,  35,
-     70, 140,   5,  10,  20,  40,  80, 160,  93, 186, 105, 210, 185, 111, 222, 161,
-     95, 190,  97, 194, 153,  47,  94, 188, 101, 202, 137,  15,  30,  60, 120, 240,
-    253, 231, 211, 187, 107, 214, 177, 127, 254, 225, 223, 163,  91, 182, 113, 226,
-    217, 175,  67, 134,  17,  34,  68, 136,  13,  26,  52, 104, 208, 189, 103, 206,
-    129,  31,  62, 124, 248, 237, 199, 147,  59, 118, 236, 197, 151,  51, 102, 204,
-    133,  23,  46,  92, 184, 109, 218, 169,  79, 158,  33,  66, 132,  21,  42,  84,
-    168,  77, 154,  41,  82, 164,  85, 170,  73, 146,  57, 114, 228, 213, 183, 115,
-    230, 209, 191,  99, 198, 145,  63, 126, 252, 229, 215, 179, 123, 246, 241, 255,
-    227, 219, 171,  75, 150,  49,  98, 196, 149,  55, 110, 220, 165,  87, 174,  65,
-    130,  25,  50, 100, 200, 141,   7,  14,  28,  56, 112, 224, 221, 167,  83, 166,
-     81, 162,  89, 178, 121, 242, 249, 239, 195, 155,  43,  86, 172,  69, 138,   9,
-     18,  36,  72, 144,  61, 122, 244, 245, 247, 243, 251, 235, 203, 139,  11,  22,
-     44,  88, 176, 125, 250, 233, 207, 131,  27,  54, 108, 216, 173,  71, 142,   1
-};
-
-/* Y = GF_EXP[X]: X = α^Y */
-static const unsigned char GF_EXP[256] =
-{
-      0,   0,   1,  25,   2,  50,  26, 198,   3, 223,  51, 238,  27, 104, 199,  75,
-      4, 100, 224,  14,  52, 141, 239, 129,  28, 193, 105, 248, 200,   8,  76, 113,
-      5, 138, 101,  47, 225,  36,  15,  33,  53, 147, 142, 218, 240,  18, 130,  69,
-     29, 181, 194, 125, 106,  39, 249, 185, 201, 154,   9, 120,  77, 228, 114, 166,
-      6, 191, 139,  98, 102, 221,  48, 253, 226, 152,  37, 179,  16, 145,  34, 136,
-     54, 208, 148, 206, 143, 150, 219, 189, 241, 210,  19,  92, 131,  56,  70,  64,
-     30,  66, 182, 163, 195,  72, 126, 110, 107,  58,  40,  84, 250, 133, 186,  61,
-    202,  94, 155, 159,  10,  21, 121,  43,  78, 212, 229, 172, 115, 243, 167,  87,
-      7, 112, 192, 247, 140, 128,  99,  13, 103,  74, 222, 237,  49, 197, 254,  24,
-    227, 165, 153, 119,  38, 184, 180, 124,  17,  68, 146, 217,  35,  32, 137,  46,
-     55,  63, 209,  91, 149, 188, 207, 205, 144, 135, 151, 178, 220, 252, 190,  97,
-    242,  86, 211, 171,  20,  42,  93, 158, 132,  60,  57,  83,  71, 109,  65, 162,
-     31,  45,  67, 216, 183, 123, 164, 118, 196,  23,  73, 236, 127,  12, 111, 246,
-    108, 161,  59,  82,  41, 157,  85, 170, 251,  96, 134, 177, 187, 204,  62,  90,
-    203,  89,  95, 176, 156, 169, 160,  81,  11, 245,  22, 235, 122, 117,  44, 215,
-     79, 174, 213, 233, 230, 231, 173, 232, 116, 214, 244, 234, 168,  80,  88, 175
-};
-
-/* Generator polynomials for Reed-Solomon error correction codewords */
-static unsigned char GP_7[]  = { 87, 229, 146, 149, 238, 102,  21};
-static unsigned char GP_10[] = {251,  67,  46,  61, 118,  70,  64,  94,  32,  45};
-static unsigned char GP_13[] = { 74, 152, 176, 100,  86, 100, 106, 104, 130, 218, 206, 140,  78};
-static unsigned char GP_15[] = {  8, 183,  61,  91, 202,  37,  51,  58,  58, 237, 140, 124,   5,  99, 105};
-static unsigned char GP_16[] = {120, 104, 107, 109, 102, 161,  76,   3,  91, 191, 147, 169, 182, 194, 225, 120};
-static unsigned char GP_17[] = { 43, 139, 206,  78,  43, 239, 123, 206, 214, 147,  24,  99, 150,  39, 243, 163, 136};
-static unsigned char GP_18[] = {215, 234, 158,  94, 184,  97, 118, 170,  79, 187, 152, 148, 252, 179,   5,  98,  96, 153};
-static unsigned char GP_20[] = { 17,  60,  79,  50,  61, 163,  26, 187, 202, 180, 221, 225,  83, 239, 156, 164, 212, 212, 188, 190};
-static unsigned char GP_22[] = {210, 171, 247, 242,  93, 230,  14, 109, 221,  53, 200,  74,   8, 172,  98,  80, 219, 134, 160, 105, 165, 231};
-static unsigned char GP_24[] = {229, 121, 135,  48, 211, 117, 251, 126, 159, 180, 169, 152, 192, 226, 228, 218, 111,   0, 117, 232,  87,  96, 227,  21};
-static unsigned char GP_26[] = {173, 125, 158,   2, 103, 182, 118,  17, 145, 201, 111,  28, 165,  53, 161,  21, 245, 142,  13, 102,  48, 227, 153, 145, 218,  70};
-static unsigned char GP_28[] = {168, 223, 200, 104, 224, 234, 108, 180, 110, 190, 195, 147, 205,  27, 232, 201,  21,  43, 245,  87,  42, 195, 212, 119, 242,  37,   9, 123};
-static unsigned char GP_30[] = { 41, 173, 145, 152, 216,  31, 179, 182,  50,  48, 110,  86, 239,  96, 222, 125,  42, 173, 226, 193, 224, 130, 156,  37, 251, 216, 238,  40, 192, 180};
-
-static unsigned char* GP_LIST[] =
-{
-     NULL,  NULL,  NULL,  NULL,  NULL,  NULL,  NULL,  GP_7,  NULL,  NULL,
-    GP_10,  NULL,  NULL, GP_13,  NULL, GP_15, GP_16, GP_17, GP_18,  NULL,
-    GP_20,  NULL, GP_22,  NULL, GP_24,  NULL, GP_26,  NULL, GP_28,  NULL,
-    GP_30
-};
-
-/* Alphanumeric characters */
-static const char ALPHA_NUMERIC_TABLE[ALPHA_NUMERIC_COUNT] =
-{
-    '0', '1', '2', '3', '4', '5', '6', '7', '8', '9',
-    'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J',
-    'K', 'L', 'M', 'N', 'O', 'P', 'Q', 'R', 'S', 'T',
-    'U', 'V', 'W', 'X', 'Y', 'Z', ' ', '$', '%', '*',
-    '+', '-', '.', '/', ':'
-};
-
 /* Number of bits in character count indicator */
 static const unsigned char BITS_OF_CHARACTER_COUNT[3][MAX_MODE] = 
 {
@@ -378,20 +332,6 @@ static const unsigned char BITS_OF_CHARACTER_COUNT[3][MAX_MODE] =
     {14, 13, 16, 12}
 };
 
-/* Convert character to alphanumeric value */
-int alpha_numeric_value(char c)
-{
-    for (int i = 0; i < ALPHA_NUMERIC_COUNT; i++)
-    {
-        if (ALPHA_NUMERIC_TABLE[i] == c)
-        {
-            return i;
-        }
-    }
-
-    return -1;
-}
-
 /* Get number of bits in character count indicator */
 int character_count_len(int mode, int version)
 {
@@ -413,159 +353,237 @@ int character_count_len(int mode, int version)
     return bits_count;
 }
 
-/* Convert int to a binary string (len bits) */
-string I2BS(int value, int len)
+/* Packed bit buffer
+ * Bits are appended MSB first, so the byte vector holds the codewords directly */
+class BIT_BUFFER
 {
-    string ret(len, '0');
+private:
+    vector<unsigned char> bytes;
+    int bits;
 
-    for (int i = 0; i < len; i++)
+public:
+    BIT_BUFFER(int capacity_bytes = 0) : bits(0)
     {
-        ret[len - i - 1] = '0' + ((value >> i) & 0x01);
+        bytes.reserve(capacity_bytes);
     }
 
-    return ret;
-}
+    /* Append the lowest len bits of value (len <= 24) */
+    void append(unsigned int value, int len)
+    {
+        while (len > 0)
+        {
+            int free = 8 - (bits & 0x07);
+            int n = (len < free) ? len : free;
 
-/* Convert binary string (8 bits) to unsigned char */
-unsigned char BS2I(string s)
-{
-    unsigned char value = 0;
+            if (free == 8)
+            {
+                bytes.push_back(0);
+            }
 
-    for (int i = 0; i < 8; i++)
-    {
-        value += (s[i] - '0') << (7 - i);
+            bytes.back() |= ((value >> (len - n)) & ((1 << n) - 1)) << (free - n);
+            len -= n;
+            bits += n;
+        }
     }
 
-    return value;
-}
-
-/* Check Shift JIS characters */
-bool is_kanji(string content)
-{
-    int data_len = content.size();
+    /* Append a whole byte, only valid at byte boundary */
+    void append_byte(unsigned char value)
+    {
+        bytes.push_back(value);
+        bits += 8;
+    }
 
-    if (data_len % 2)
+    /* Number of bits written */
+    int size() const
     {
-        return false;
+        return bits;
     }
 
-    for (int i = 0; i < data_len; i+=2)
+    vector<unsigned char> &data()
     {
-        unsigned char c = content[i];
-        if ((c < 0x81 || c > 0x9F) && (c < 0xE0 || c > 0xEB))
-        {
-            return false;
-        }
+        return bytes;
     }
+};
 
-    return true;
-}
+/* Cheapest split of content into segments for the character count indicator lengths of version
+ * Dynamic program over byte positions with the mode of the open segment as state,
+ * boundaries are the character class runs of classify_content.
+ * Costs are in 1/6 bits so that NUMERIC (10/3 bits) and ALPHA_NUMERIC (11/2 bits) characters are whole,
+ * a segment is rounded up to whole bits when the next one starts.
+ * Returns the number of data bits (ECI header included), -1 if content is empty */
+int segment_content(const string &content, const vector<int> &boundaries, int version, int encoding, vector<SEGMENT> &segments)
+{
+    static const int char_cost[MAX_MODE] = {20, 33, 48, 78};
+    int n = content.size();
 
-/* Check UTF-8 characters 
- * 1-byte 0xxxxxxx 
- * 2-byte 110xxxxx 10xxxxxx 
- * 3-byte 1110xxxx 10xxxxxx 10xxxxxx 
- * 4-byte 11110xxx 10xxxxxx 10xxxxxx 10xxxxxx 
- * 5-byte 111110xx 10xxxxxx 10xxxxxx 10xxxxxx 10xxxxxx 
- * 6-byte 1111110x 10xxxxxx 10xxxxxx 10xxxxxx 10xxxxxx 10xxxxxx */  
-bool is_UTF8(string content)
-{
-    int bytes = 0;
-    bool all_ascii = true;
- 
-    for (unsigned int i = 0; i < content.size(); i++)
+    segments.clear();
+    if (0 == n)
     {
-        unsigned char c = content[i];
+        return -1;
+    }
+
+    /* cost[i*MAX_MODE + m]: first i bytes, last segment in mode m
+     * from[i*MAX_MODE + m]: mode before the last character, MAX_MODE at the start of content */
+    vector<int> cost((n + 1)*MAX_MODE, INT_MAX);
+    vector<signed char> from((n + 1)*MAX_MODE, MAX_MODE);
 
-        if ((c & 0x80) != 0)
+    for (int i = 0, run = 0, cls = BYTE; i < n; i++)
+    {
+        /* The character class only changes at run boundaries */
+        if (run < (int)boundaries.size() && boundaries[run] == i)
         {
-            all_ascii = false;
+            cls = character_class(content[i]);
+            run++;
         }
-            
-        if (bytes == 0)
+
+        /* Cheapest way to close the segment before byte i */
+        int closed = 0, closed_mode = MAX_MODE;
+
+        if (i > 0)
         {
-            if ((c & 0x80) != 0)
+            closed = INT_MAX;
+            for (int m = 0; m < MAX_MODE; m++)
             {
-                while ((c & 0x80) != 0)
-                {
-                    c <<= 1;
-                    bytes++;
-                }
+                int c = cost[i*MAX_MODE + m];
 
-                if (bytes < 2 || bytes > 6)
+                if (c != INT_MAX && (c + 5)/6*6 < closed)
                 {
-                    return false;
+                    closed = (c + 5)/6*6;
+                    closed_mode = m;
                 }
-
-                bytes--;
             }
         }
-        else
+
+        bool allowed[MAX_MODE];
+
+        allowed[NUMERIC] = (NUMERIC == cls);
+        allowed[ALPHA_NUMERIC] = (BYTE != cls);
+        allowed[BYTE] = true;
+        allowed[KANJI] = (BYTE == cls) && (UTF_8 != encoding) && (i + 1 < n) && is_kanji_pair(content[i], content[i + 1]);
+
+        for (int m = 0; m < MAX_MODE; m++)
         {
-            if ((c & 0xC0) != 0x80)
+            if (!allowed[m])
+            {
+                continue;
+            }
+
+            int j = i + ((KANJI == m) ? 2 : 1);
+            int stay = cost[i*MAX_MODE + m];
+            int total = (INT_MAX == closed) ? INT_MAX : closed + (4 + character_count_len(m, version))*6 + char_cost[m];
+            int prev = closed_mode;
+
+            /* Continue the open segment, a new segment in the same mode is never cheaper */
+            if (stay != INT_MAX && stay + char_cost[m] <= total)
+            {
+                total = stay + char_cost[m];
+                prev = m;
+            }
+
+            if (total < cost[j*MAX_MODE + m])
             {
-                return false;
+                cost[j*MAX_MODE + m] = total;
+                from[j*MAX_MODE + m] = (signed char)prev;
             }
-                
-            bytes--;
         }
     }
 
-    if (all_ascii)
+    int last = BYTE;
+    for (int m = 0; m < MAX_MODE; m++)
     {
-        return false;
+        if (cost[n*MAX_MODE + m] != INT_MAX && (cost[n*MAX_MODE + m] + 5)/6 < (cost[n*MAX_MODE + last] + 5)/6)
+        {
+            last = m;
+        }
     }
-        
-    return (bytes == 0);
-}
 
-/* Determine mode of content */
-int mode_check(string content)
-{
-    int mode = -1;
+    int bits = (cost[n*MAX_MODE + last] + 5)/6 + ((UTF_8 == encoding) ? 12 : 0);
 
-    if (is_kanji(content))
+    /* Walk back, a segment starts where the previous mode differs */
+    for (int i = n, end = n, m = last; m != MAX_MODE; )
     {
-        return KANJI;
-    }
+        int prev = from[i*MAX_MODE + m];
 
-    for (unsigned int i = 0; i < content.size(); i++)
-    {
-        char c = content[i];
-        if (c >= '0' && c <= '9')
-        {
-            mode = (mode < NUMERIC) ? NUMERIC : mode;
-        }
-        else if (alpha_numeric_value(c) >= 0)
-        {
-            mode = (mode < ALPHA_NUMERIC) ? ALPHA_NUMERIC : mode;
-        }
-        else
+        i -= (KANJI == m) ? 2 : 1;
+        if (prev != m)
         {
-            mode = BYTE;
+            SEGMENT segment = {m, i, end - i};
+            segments.push_back(segment);
+            end = i;
+            m = prev;
         }
     }
 
-    return mode;
+    std::reverse(segments.begin(), segments.end());
+
+    return bits;
 }
 
-/* Determine encoding of content: default or UTF8 */
-int encoding_check(string content)
+/* Max characters (KANJI: double-byte characters) that fit in each version
+ * by encoding, mode and error correction level, derived from QR_info and BITS_OF_CHARACTER_COUNT */
+class CAPACITY_TABLE
+{
+public:
+    int chars[2][MAX_MODE][QR_EC_LEVEL][QR_MAX_VERSION];
+
+    CAPACITY_TABLE();
+};
+
+CAPACITY_TABLE::CAPACITY_TABLE()
 {
-    if (is_UTF8(content))
+    for (int encoding = ISO_8859_1; encoding <= UTF_8; encoding++)
     {
-        return UTF_8;
+        for (int mode = 0; mode < MAX_MODE; mode++)
+        {
+            for (int level = 0; level < QR_EC_LEVEL; level++)
+            {
+                for (int v = QR_MIN_VERSION; v <= QR_MAX_VERSION; v++)
+                {
+                    int count_len = character_count_len(mode, v);
+                    /* ECI header room is kept for all UTF-8 content, as version_check always did */
+                    int eci_len = (UTF_8 == encoding) ? 12 : 0;
+                    int bits = QR_info[v - 1].data_bytes[level]*8 - 4 - count_len - eci_len;
+                    int n = 0;
+
+                    switch(mode)
+                    {
+                        case NUMERIC:
+                            n = 3*(bits/10) + ((bits % 10 >= 7) ? 2 : ((bits % 10 >= 4) ? 1 : 0));
+                        break;
+
+                        case ALPHA_NUMERIC:
+                            n = 2*(bits/11) + ((bits % 11 >= 6) ? 1 : 0);
+                        break;
+
+                        case BYTE:
+                            n = bits/8;
+                        break;
+
+                        case KANJI:
+                            n = bits/13;
+                        break;
+                    }
+
+                    /* Character count indicator limit */
+                    chars[encoding][mode][level][v - 1] = (n < (1 << count_len)) ? n : (1 << count_len) - 1;
+                }
+            }
+        }
     }
+}
 
-    return ISO_8859_1;
+static const CAPACITY_TABLE &capacity_table()
+{
+    static const CAPACITY_TABLE table;
+    return table;
 }
 
-/* Determine most appropriate version */
-int version_check(string content, int ec_level, int version, int mode, int encoding)
+/* Determine most appropriate version
+ * Capacity grows with the version, so the smallest one that holds content is found by binary search */
+int version_check(const string &content, int ec_level, int version, int mode, int encoding)
 {
+    const int *capacity = capacity_table().chars[encoding][mode][ec_level];
     int data_len = content.size();
-    int eci_len = (UTF_8 == encoding) ? 12 : 0;
-    int min_ver = QR_MIN_VERSION, max_ver = QR_MAX_VERSION;
 
     if (KANJI == mode)
     {
@@ -574,126 +592,63 @@ int version_check(string content, int ec_level, int version, int mode, int encod
 
     if (AUTO_VERSION != version)
     {
-        min_ver = max_ver = version;
+        return (data_len <= capacity[version - 1]) ? version : -1;
     }
 
-    for (int v = min_ver; v <= max_ver; v++)
-    {
-        int capacity = 4 + character_count_len(mode, v) + eci_len;
-
-        switch(mode)
-        {
-            case NUMERIC:
-            {
-                int r = (data_len % 3 == 0) ? 0 : ((data_len % 3 == 1) ? 4 : 7);
-                capacity += (10*(data_len/3) + r);
-            }         
-            break;
-
-            case ALPHA_NUMERIC:
-                capacity += (11*(data_len/2) + 6*(data_len % 2));
-            break;
-
-            case BYTE:
-                capacity += 8*data_len;
-            break;
-
-            case KANJI:
-                capacity += 13*data_len;
-            break;
-        }
+    const int *fit = std::lower_bound(capacity, capacity + QR_MAX_VERSION, data_len);
 
-        if (capacity <= QR_info[v - 1].data_bytes[ec_level]*8)
-        {
-            return v;
-        }
-    }
-        
-    return -1;
+    return (fit == capacity + QR_MAX_VERSION) ? -1 : (int)(fit - capacity) + QR_MIN_VERSION;
 }
 
-string eci_header(int mode, int encoding)
+void eci_header(BIT_BUFFER &bits, int mode, int encoding)
 {
-    string ret = "";
-
     if ((BYTE == mode) && (UTF_8 == encoding))
     {
-        /* ECI mode indicator */
-        ret += "0111";
+        /* ECI mode indicator: 0111 */
+        bits.append(0x07, 4);
         /* ECI Assignment number (000026) */
-        ret += "00011010";
+        bits.append(26, 8);
     }
-
-    return ret;
 }
 
-string mode_indicator(int mode)
+/* NUMERIC: 0001; ALPHA_NUMERIC: 0010; BYTE: 0100; KANJI: 1000 */
+void mode_indicator(BIT_BUFFER &bits, int mode)
 {
-    string ret = "";
-
-    switch(mode)
-    {
-        case NUMERIC:
-            ret = "0001";
-        break;
-
-        case ALPHA_NUMERIC:
-            ret = "0010";
-        break;
-
-        case BYTE:
-            ret = "0100";
-        break;
-
-        case KANJI:
-            ret = "1000";
-        break;
-    }
-
-    return ret;
+    bits.append(1 << mode, 4);
 }
 
-string character_count(int len, int mode, int version)
+void character_count(BIT_BUFFER &bits, int len, int mode, int version)
 {
     if (KANJI == mode)
     {
         len /= 2;
     }
 
-    return I2BS(len, character_count_len(mode, version));
+    bits.append(len, character_count_len(mode, version));
 }
 
 /* NUMERIC MODE:
  * Input characters are divied into groups of 3 characters
  * For each group, Converted to its 10-bit binary equivalent.
  * If the number of data is NOT a multiple of 3
- * the final 1 or 2 digits I2BSerted to 4 or 7 bits binary number */
-string encode_numeric(string content)
+ * the final 1 or 2 digits converted to 4 or 7 bits binary number */
+void encode_numeric(BIT_BUFFER &bits, const string &content)
 {
-    string ret = "";
+    static const int group_bits[] = {0, 4, 7, 10};
+    int data_len = content.size();
 
-    for (unsigned int i = 0; i < content.size(); i+=3)
+    for (int i = 0; i < data_len; i+=3)
     {
-        string num = "";
+        int digits = (data_len - i < 3) ? (data_len - i) : 3;
+        int num = 0;
 
-        if ((i + 1 < content.size()) && (i + 2 < content.size()))
+        for (int j = 0; j < digits; j++)
         {
-            num = content.substr(i, 3);
-            ret += I2BS(atoi(num.c_str()), 10);
+            num = num*10 + (content[i + j] - '0');
         }
-        else if (i + 1 < content.size())
-        {
-            num = content.substr(i, 2);
-            ret += I2BS(atoi(num.c_str()), 7);
-        }
-        else
-        {
-            num = content.substr(i, 1);
-            ret += I2BS(atoi(num.c_str()), 4);
-        }
-    }
 
-    return ret;
+        bits.append(num, group_bits[digits]);
+    }
 }
 
 /* ALPHA_NUMERIC MODE:
@@ -701,10 +656,8 @@ string encode_numeric(string content)
  * For each group, character value of the 1st character multiplied by 45 and add the 2nd
  * the result encoded as 11-bit binary number
  * If the number of data is NOT a multiple of 2, the final character is encoded as a 6-bit binary number */
-string encode_alpha_numeric(string content)
+void encode_alpha_numeric(BIT_BUFFER &bits, const string &content)
 {
-    string ret = "";
-
     for (unsigned int i = 0; i < content.size(); i+=2)
     {
         int a = alpha_numeric_value(content[i]);
@@ -712,29 +665,23 @@ string encode_alpha_numeric(string content)
         if (i + 1 < content.size())
         {
             int b = alpha_numeric_value(content[i + 1]);
-            ret += I2BS(a*45 + b, 11);
+            bits.append(a*45 + b, 11);
         }
         else
         {
-            ret += I2BS(a, 6);
+            bits.append(a, 6);
         }
     }
-
-    return ret;
 }
 
 /* BYTE MODE:
  * One 8-bit codeword directly represents the byte value of the input data character*/
-string encode_byte(string content)
+void encode_byte(BIT_BUFFER &bits, const string &content)
 {
-    string ret = "";
-
     for (unsigned int i = 0; i < content.size(); i++)
     {
-        ret += I2BS(content[i], 8);
+        bits.append(content[i] & 0xFF, 8);
     }
-
-    return ret;
 }
 
 /* KANJI MODE:
@@ -742,13 +689,11 @@ string encode_byte(string content)
  * characters with Shift JIS values from 0x8140 to 0x9FFC: Subtract 0x8140
  * characters with Shift JIS values from 0xE040 to 0xEBBF: Subtract 0xC140
  * Multiply most significant byte of result by 0xC0, and add least significant byte to product */
-string encode_kanji(string content)
+void encode_kanji(BIT_BUFFER &bits, const string &content)
 {
-    string ret = "";
-
     for (unsigned int i = 0; i < content.size(); i+=2)
     {
-        int v = ((content[i] & 0xFF) << 8) | content[i + 1];
+        int v = ((content[i] & 0xFF) << 8) | (content[i + 1] & 0xFF);
         
         if (v >= 0x8140 && v <= 0x9FFC)
         {
@@ -760,118 +705,156 @@ string encode_kanji(string content)
         }
 
         v = ((v >> 8) * 0xC0) + (v & 0x00FF);
-        ret += I2BS(v, 13);
+        bits.append(v, 13);
     }
-
-    return ret;
 }
 
-string encode_content(string content, int mode)
+void encode_content(BIT_BUFFER &bits, const string &content, int mode)
 {
-    string ret = "";
-
     switch(mode)
     {
         case NUMERIC:
-            ret = encode_numeric(content);
+            encode_numeric(bits, content);
         break;
 
         case ALPHA_NUMERIC:
-            ret = encode_alpha_numeric(content);
+            encode_alpha_numeric(bits, content);
         break;
 
         case BYTE:
-            ret = encode_byte(content);
+            encode_byte(bits, content);
         break;
 
         case KANJI:
-            ret = encode_kanji(content);
+            encode_kanji(bits, content);
         break;
     }
-
-    return ret;
 }
 
-string terminator(int curr_bits_count, int version, int ec_level)
+void terminator(BIT_BUFFER &bits, int version, int ec_level)
 {
     int max_bits = QR_info[version - 1].data_bytes[ec_level]*8;
-    return (curr_bits_count <= (max_bits - 4)) ? "0000" : "";
+
+    if (bits.size() <= max_bits - 4)
+    {
+        bits.append(0x00, 4);
+    }
 }
 
-string padding_bits(int curr_bits_count)
+void padding_bits(BIT_BUFFER &bits)
 {
-    int need_bits = ((curr_bits_count + 7)/8)*8 - curr_bits_count;
-    return (need_bits > 0) ? string(need_bits, '0') : "";
+    int need_bits = ((bits.size() + 7)/8)*8 - bits.size();
+
+    if (need_bits > 0)
+    {
+        bits.append(0x00, need_bits);
+    }
 }
 
-string padding_codewords(int curr_bits_count, int version, int ec_level)
+void padding_codewords(BIT_BUFFER &bits, int version, int ec_level)
 {
-    string ret = "";
     bool flg = true;
 
     int max_bits = QR_info[version - 1].data_bytes[ec_level]*8;
-    while(curr_bits_count < max_bits)
+    while(bits.size() < max_bits)
     {
-        ret += (flg ? "11101100" : "00010001");
-
+        /* 11101100, 00010001 */
+        bits.append_byte(flg ? 0xEC : 0x11);
         flg = !flg;
-        curr_bits_count += 8;
     }
-
-    return ret;
 }
 
-string Reed_Solomon(string block_str, int data_bytes, int rs_bytes)
+/* Error correction codewords of all blocks, block after block */
+void error_correction(const vector<unsigned char> &data, vector<unsigned char> &ec, int version, int ec_level)
 {
-    string ret = "";
-
-    unsigned char *rs = new unsigned char [data_bytes + rs_bytes];
-    memset(rs, 0, data_bytes + rs_bytes);
+    int data_pos = 0, ec_pos = 0;
 
-    for (int i = 0; i < data_bytes; i++)
+    for (int i = 0; i <= 1; i++)
     {
-        rs[i] = BS2I(block_str.substr(i*8, 8));
+        EC_INFO info = QR_info[version - 1].ec_info[i][ec_level];
+        int rs_bytes = info.block_bytes - info.block_data_bytes;
+
+        for (int j = 0; j < info.blocks; j++)
+        {
+            rs_encode(&data[data_pos], info.block_data_bytes, &ec[ec_pos], rs_bytes);
+
+            data_pos += info.block_data_bytes;
+            ec_pos += rs_bytes;
+        }
     }
+}
 
-    for (int i = 0; i < data_bytes; i++)
+/* Error correction codewords of all blocks from their parity templates */
+void error_correction(const vector<unsigned char> &data, vector<unsigned char> &ec, int version, int ec_level, const vector<RS_TEMPLATE> &blocks)
+{
+    int data_pos = 0, ec_pos = 0, block = 0;
+
+    for (int i = 0; i <= 1; i++)
     {
-        if (rs[0] != 0)
-        {
-            int first = GF_EXP[rs[0]];
+        EC_INFO info = QR_info[version - 1].ec_info[i][ec_level];
 
-            for (int j = 0; j < rs_bytes; j++)
-            {
-                int ele = GP_LIST[rs_bytes][j] + first;
-                ele = ele % 255;
-                rs[j] = rs[j + 1] ^ GF_INT[ele];
-            }
+        for (int j = 0; j < info.blocks; j++)
+        {
+            blocks[block++].encode(&data[data_pos], &ec[ec_pos]);
 
-            for (int j = rs_bytes; j < data_bytes + rs_bytes - 1; j++)
-            {
-                rs[j] = rs[j + 1];
-            }
+            data_pos += info.block_data_bytes;
+            ec_pos += info.block_bytes - info.block_data_bytes;
         }
-        else
-        {
-            for (int j = 0; j < data_bytes + rs_bytes - 1; j++)
-            {
-                rs[j] = rs[j + 1];
-            }
-        }  
     }
+}
+
+/* Block b of both ec_info groups, and the offsets of its data and error correction codewords */
+static EC_INFO block_info(int version, int ec_level, int b, int &data_pos, int &ec_pos)
+{
+    EC_INFO first = QR_info[version - 1].ec_info[0][ec_level];
+    EC_INFO info = first;
+
+    data_pos = b*first.block_data_bytes;
+    ec_pos = b*(first.block_bytes - first.block_data_bytes);
 
-    for (int i = 0; i < rs_bytes; i++)
+    if (b >= first.blocks)
     {
-        ret += I2BS(rs[i], 8);
+        info = QR_info[version - 1].ec_info[1][ec_level];
+        b -= first.blocks;
+
+        data_pos = first.blocks*first.block_data_bytes + b*info.block_data_bytes;
+        ec_pos = first.blocks*(first.block_bytes - first.block_data_bytes) + b*(info.block_bytes - info.block_data_bytes);
     }
-    delete [] rs;
-    return ret;
+
+    return info;
+}
+
+/* Error correction codewords with the blocks run on executor
+ * Each block writes its own slot of ec, so the interleaving reads them in place */
+void error_correction(const vector<unsigned char> &data, vector<unsigned char> &ec, int version, int ec_level,
+                      const vector<RS_TEMPLATE> *templates, const EXECUTOR &executor)
+{
+    int blocks = QR_info[version - 1].ec_info[0][ec_level].blocks + QR_info[version - 1].ec_info[1][ec_level].blocks;
+
+    executor(blocks, [&](int b)
+    {
+        int data_pos, ec_pos;
+        EC_INFO info = block_info(version, ec_level, b, data_pos, ec_pos);
+
+        if (templates)
+        {
+            (*templates)[b].encode(&data[data_pos], &ec[ec_pos]);
+        }
+        else
+        {
+            rs_encode(&data[data_pos], info.block_data_bytes, &ec[ec_pos], info.block_bytes - info.block_data_bytes);
+        }
+    });
 }
 
-string error_correction(string qr_str, int version, int ec_level)
+/* Error correction codewords of several messages of the same version and level
+ * Block j of all messages is encoded in lock-step */
+void error_correction(const vector<const unsigned char *> &data, const vector<unsigned char *> &ec, int version, int ec_level)
 {
-    string ret = "";
-    int start_pos = 0;
+    int count = data.size();
+    int data_pos = 0, ec_pos = 0;
+    vector<const unsigned char *> block_data(count);
+    vector<unsigned char *> block_ec(count);
 
     for (int i = 0; i <= 1; i++)
     {
@@ -880,14 +863,25 @@ string error_correction(string qr_str, int version, int ec_level)
 
         for (int j = 0; j < info.blocks; j++)
         {
-            string block_str = qr_str.substr(start_pos, info.block_data_bytes*8);
-            ret += Reed_Solomon(block_str, info.block_data_bytes, rs_bytes);
+            for (int m = 0; m < count; m++)
+            {
+                block_data[m] = data[m] + data_pos;
+                block_ec[m] = ec[m] + ec_pos;
+            }
+
+            rs_encode_batch(&block_data[0], &block_ec[0], count, info.block_data_bytes, rs_bytes);
 
-            start_pos += info.block_data_bytes*8;
+            data_pos += info.block_data_bytes;
+            ec_pos += rs_bytes;
         }
     }
-    
-    return ret;
+}
+
+/* Set a function pattern module: 0 (light); 1 (dark) */
+void QR::function_module(int x, int y, int value)
+{
+    DARK_PLANE.set(x, y, value);
+    FUNCTION_PLANE.set(x, y, true);
 }
 
 /* Three Finder Patterns located at the upper left, upper right and lower left corners
@@ -909,7 +903,7 @@ void QR::finder_pattern(int x, int y)
     {
         for (int j = 0; j < FINDER_PATTERN_SIZE; j++)
         {
-            QR_DATA[(x + i)*SIZE + (y + j)] = pattern[i][j] + MODULE_FUNCION_PATTERN;
+            function_module(x + i, y + j, pattern[i][j]);
         }
     }
 }
@@ -920,13 +914,13 @@ void QR::separator()
 {
     for (int i = 0; i < 8; i++)
     {
-        QR_DATA[7*SIZE + i] = 0 + MODULE_FUNCION_PATTERN;
-        QR_DATA[7*SIZE + SIZE - 8 + i] = 0 + MODULE_FUNCION_PATTERN;
-        QR_DATA[(SIZE - 8)*SIZE + i] = 0 + MODULE_FUNCION_PATTERN;
+        function_module(7, i, 0);
+        function_module(7, SIZE - 8 + i, 0);
+        function_module(SIZE - 8, i, 0);
 
-        QR_DATA[i*SIZE + 7] = 0 + MODULE_FUNCION_PATTERN;
-        QR_DATA[(SIZE - 8 + i)*SIZE + 7] = 0 + MODULE_FUNCION_PATTERN;
-        QR_DATA[i*SIZE + SIZE - 8] = 0 + MODULE_FUNCION_PATTERN;
+        function_module(i, 7, 0);
+        function_module(SIZE - 8 + i, 7, 0);
+        function_module(i, SIZE - 8, 0);
     }
 }
 
@@ -936,7 +930,8 @@ void QR::timing_pattern()
 {
     for (int i = FINDER_PATTERN_SIZE + 1; i < SIZE - FINDER_PATTERN_SIZE - 1; i++)
     {
-        QR_DATA[6*SIZE + i] = QR_DATA[i*SIZE + 6] = ((i + 1) % 2) + MODULE_FUNCION_PATTERN;
+        function_module(6, i, (i + 1) % 2);
+        function_module(i, 6, (i + 1) % 2);
     }
 }
 
@@ -962,7 +957,7 @@ void QR::align_pattern()
             int x = info.align_coord[i];
             int y = info.align_coord[j];
 
-            if (x && y && QR_DATA[x*SIZE + y] == MODULE_NOT_SET)
+            if (x && y && !FUNCTION_PLANE.get(x, y))
             {
                 /* (x, y) is center coordinate, left top is (x-2, y-2) */
                 x -= 2;
@@ -972,7 +967,7 @@ void QR::align_pattern()
                 {
                     for (int n = 0; n < ALIGN_PATTERN_SIZE; n++)
                     {
-                        QR_DATA[(x + m)*SIZE + (y + n)] = pattern[m][n] + MODULE_FUNCION_PATTERN;
+                        function_module(x + m, y + n, pattern[m][n]);
                     }
                 }
             }
@@ -980,11 +975,36 @@ void QR::align_pattern()
     }
 }
 
+/* Place the 15 format information bits (and the dark module) into plane
+ * bits 0~7: rows 0~5, 7, 8 of column 8, and columns SIZE-1 ~ SIZE-8 of row 8
+ * bits 8~14: columns 7, 5~0 of row 8, and rows SIZE-7 ~ SIZE-1 of column 8 */
+static void format_modules(int format, int size, BIT_MATRIX &plane)
+{
+    for (int i = 0; i < 15; i++)
+    {
+        bool bit = (format >> i) & 0x01;
+
+        if (i < 8)
+        {
+            plane.set((i < 6) ? i : i + 1, 8, bit);
+            plane.set(8, size - 1 - i, bit);
+        }
+        else
+        {
+            plane.set(8, (i == 8) ? 7 : 14 - i, bit);
+            plane.set(size - 15 + i, 8, bit);
+        }
+    }
+
+    /* Dark module */
+    plane.set(size - 8, 8, true);
+}
+
 /* The format information is a 15-bit sequence
  * containing 5 data bits, with 10 error correction bits calculated using the (15, 5) BCH code
  * data bits 0~2: data mask pattern
  * data bits 3~4: error correction level (L:01; M:00; Q:11; H:10) */
-void QR::format_info(int data_mask)
+void QR::format_info(int data_mask, BIT_MATRIX &plane)
 {
     int format;
 
@@ -1021,24 +1041,7 @@ void QR::format_info(int data_mask)
     format = (format << 10) + coefficient;
     format ^= 0x5412; /* masking shall be applied by XORing the bit string with 101010000010010 (0x5412) */
 
-    QR_DATA[8] = QR_DATA[8*SIZE + SIZE - 1] = (format & 0x01) + MODULE_FUNCION_PATTERN;
-    QR_DATA[SIZE + 8] = QR_DATA[8*SIZE + SIZE - 2] = ((format >> 1) & 0x01) + MODULE_FUNCION_PATTERN;
-    QR_DATA[2*SIZE + 8] = QR_DATA[8*SIZE + SIZE - 3] = ((format >> 2) & 0x01) + MODULE_FUNCION_PATTERN;
-    QR_DATA[3*SIZE + 8] = QR_DATA[8*SIZE + SIZE - 4] = ((format >> 3) & 0x01) + MODULE_FUNCION_PATTERN;
-    QR_DATA[4*SIZE + 8] = QR_DATA[8*SIZE + SIZE - 5] = ((format >> 4) & 0x01) + MODULE_FUNCION_PATTERN;
-    QR_DATA[5*SIZE + 8] = QR_DATA[8*SIZE + SIZE - 6] = ((format >> 5) & 0x01) + MODULE_FUNCION_PATTERN;
-    QR_DATA[7*SIZE + 8] = QR_DATA[8*SIZE + SIZE - 7] = ((format >> 6) & 0x01) + MODULE_FUNCION_PATTERN;
-    QR_DATA[8*SIZE + 8] = QR_DATA[8*SIZE + SIZE - 8] = ((format >> 7) & 0x01) + MODULE_FUNCION_PATTERN;
-    /* Dark module */
-    QR_DATA[(SIZE-8)*SIZE + 8] = 1 + MODULE_FUNCION_PATTERN;
-
-    QR_DATA[8*SIZE + 7] = QR_DATA[(SIZE - 7)*SIZE + 8] = ((format >> 8) & 0x01) + MODULE_FUNCION_PATTERN;
-    QR_DATA[8*SIZE + 5] = QR_DATA[(SIZE - 6)*SIZE + 8] = ((format >> 9) & 0x01) + MODULE_FUNCION_PATTERN;
-    QR_DATA[8*SIZE + 4] = QR_DATA[(SIZE - 5)*SIZE + 8] = ((format >> 10) & 0x01) + MODULE_FUNCION_PATTERN;
-    QR_DATA[8*SIZE + 3] = QR_DATA[(SIZE - 4)*SIZE + 8] = ((format >> 11) & 0x01) + MODULE_FUNCION_PATTERN;
-    QR_DATA[8*SIZE + 2] = QR_DATA[(SIZE - 3)*SIZE + 8] = ((format >> 12) & 0x01) + MODULE_FUNCION_PATTERN;
-    QR_DATA[8*SIZE + 1] = QR_DATA[(SIZE - 2)*SIZE + 8] = ((format >> 13) & 0x01) + MODULE_FUNCION_PATTERN;
-    QR_DATA[8*SIZE + 0] = QR_DATA[(SIZE - 1)*SIZE + 8] = ((format >> 14) & 0x01) + MODULE_FUNCION_PATTERN;
+    format_modules(format, SIZE, plane);
 }
 
 /* The version information is a 18-bit sequence
@@ -1068,28 +1071,32 @@ void QR::version_info()
     {
         for (int j = 0; j < 3; j++)
         {
-            QR_DATA[i*SIZE + (SIZE - 11 + j)] = ((ver_data >> (i*3 + j)) & 0x01) + MODULE_FUNCION_PATTERN;
-            QR_DATA[(SIZE - 11 + j)*SIZE + i] = ((ver_data >> (i*3 + j)) & 0x01) + MODULE_FUNCION_PATTERN;
+            function_module(i, SIZE - 11 + j, (ver_data >> (i*3 + j)) & 0x01);
+            function_module(SIZE - 11 + j, i, (ver_data >> (i*3 + j)) & 0x01);
         }
     }
 }
 
 /* Symbol characters are positioned in two-module wide columns
  * commencing at the lower right corner of the symbol
- * and running alternately upwards and downwards from the right to the left */
-void QR::data_pattern(string qr_str)
+ * and running alternately upwards and downwards from the right to the left
+ * The walk only depends on the version: table[i] is the module of bit i of the codeword sequence */
+void QR::placement_table(vector<unsigned short> &table)
 {
     int x = SIZE - 1;
     int y = SIZE - 1;
     bool upwards = true;
     bool left = true;
 
-    for (int i = 0; i < QR_info[VERSION - 1].total_bytes*8;)
+    table.clear();
+    table.reserve(QR_info[VERSION - 1].total_bytes*8);
+
+    while ((int)table.size() < QR_info[VERSION - 1].total_bytes*8)
     {
-        if (QR_DATA[x*SIZE + y] == MODULE_NOT_SET)
+        if (!FUNCTION_PLANE.get(x, y))
         {
-            QR_DATA[x*SIZE + y] = qr_str[i] - '0';
-            i++;
+            /* Bit offset of the module in the plane */
+            table.push_back(x*FUNCTION_PLANE.words*64 + y);
         }
         
         if (upwards)
@@ -1138,364 +1145,795 @@ void QR::data_pattern(string qr_str)
     }
 }
 
-bool QR::is_light_row(int row, int start_col)
+/* 1. Data masking is not applied to function patterns.
+ * 2. Data masking is performed on the encoding region (excluding format information and version information)
+ * 3. Although the data masking is performed on encoding region, the area to be evaluated is the complete symbol.
+ * 4. Select the pattern with the lowest penalty points score. */
+int QR::data_mask_evaluation(const QR_OPTIONS &options)
 {
-    int end_col = start_col + 3;
+    int penalty[8];
+    std::atomic<int> limit(INT_MAX);
 
-    start_col = (start_col < 0) ? 0 : start_col;
-    end_col = (end_col > SIZE - 1) ? SIZE - 1 : end_col;
-
-    for (int i = start_col; i <= end_col; i++)
+    /* Each candidate is scored on its own copy of the symbol */
+    auto evaluate = [&](int i)
     {
-        if (QR_DATA[row*SIZE + i] & 0x01)
+        BIT_MATRIX candidate = TEMPLATE->mask[i];
+
+        for (unsigned int k = 0; k < candidate.bits.size(); k++)
         {
-            return false;
+            candidate.bits[k] ^= DARK_PLANE.bits[k];
         }
-    }
+        format_info(i, candidate);
 
-    return true;
-}
+        if (options.mask_early_exit)
+        {
+            penalty[i] = penalty_score(candidate, &limit);
 
-bool QR::is_light_col(int col, int start_row)
-{
-    int end_row = start_row + 3;
+            /* Lower the limit to the best penalty so far */
+            int best = limit.load();
+            while (penalty[i] < best && !limit.compare_exchange_weak(best, penalty[i]))
+            {
+            }
+        }
+        else
+        {
+            penalty[i] = penalty_score(candidate);
+        }
+    };
+
+    if (1 == options.mask_threads || VERSION < MASK_PARALLEL_VERSION)
+    {
+        for (int i = 0; i < 8; i++)
+        {
+            evaluate(i);
+        }
+    }
+    else
+    {
+        parallel_for(8, options.mask_threads, evaluate);
+    }
 
-    start_row = (start_row < 0) ? 0 : start_row;
-    end_row = (end_row > SIZE - 1) ? SIZE - 1 : end_row;
+    /* Candidates stopped early scored above the lowest penalty, ties go to the lower pattern */
+    int data_mask = 0;
 
-    for (int i = start_row; i <= end_row; i++)
+    for (int i = 1; i < 8; i++)
     {
-        if (QR_DATA[i*SIZE + col] & 0x01)
+        if (penalty[i] < penalty[data_mask])
         {
-            return false;
+            data_mask = i;
         }
     }
 
-    return true;
+    return data_mask;
 }
 
-int QR::data_mask_score()
+/* Data mask condition of module in row i, column j */
+static bool mask_condition(int data_mask, int i, int j)
 {
-    int score = 0;
-    int i, j, k;
+    bool mask = false;
 
-    /* Adjacent modules in column in same color: penalty socre N1 = 3 */
-    for (i = 0; i < SIZE; i++)
+    switch(data_mask)
     {
-        for (j = 0; j < SIZE - 4; j++)
-        {
-            int count = 1;
+        case 0:
+            mask = ((i + j) % 2 == 0);
+        break;
 
-            for (k = j + 1; k < SIZE; k++)
-            {
-                if ((QR_DATA[i*SIZE + j] & 0x01) == (QR_DATA[i*SIZE + k] & 0x01))
-                {
-                    count++;
-                }
-                else
-                {
-                    break;
-                }
-            }
+        case 1:
+            mask = (i % 2 == 0);
+        break;
 
-            if (count >= 5)
-            {
-                score += (count - 5) + 3;
-            }
+        case 2:
+            mask = (j % 3 == 0);
+        break;
 
-            j = k - 1;
-        }
+        case 3:
+            mask = ((i + j) % 3 == 0);
+        break;
+
+        case 4:
+            mask = (((i / 2) + (j / 3)) % 2 == 0);
+        break;
+
+        case 5:
+            mask = (((i * j) % 2) + ((i * j) % 3) == 0);
+        break;
+
+        case 6:
+            mask = ((((i * j) % 2) + ((i * j) % 3)) % 2 == 0);
+        break;
+
+        case 7:
+            mask = ((((i + j) % 2) + ((i * j) % 3)) % 2 == 0);
+        break;
     }
 
-    /* Adjacent modules in row in same color: penalty socre N1 = 3 */
-    for (i = 0; i < SIZE; i++)
+    return mask;
+}
+
+/* Modules flipped by the data mask: the mask pattern without the function patterns
+ * All mask patterns repeat every 12 rows, so only the first 12 rows are evaluated module by module */
+void QR::data_mask_plane(int data_mask, BIT_MATRIX &plane)
+{
+    BIT_MATRIX pattern(SIZE);
+
+    for (int i = 0; i < 12; i++)
     {
-        for (j = 0; j < SIZE - 4; j++)
+        for (int j = 0; j < SIZE; j++)
         {
-            int count = 1;
+            pattern.set(i, j, mask_condition(data_mask, i, j));
+        }
+    }
 
-            for (k = j + 1; k < SIZE; k++)
-            {
-                if ((QR_DATA[j*SIZE + i] & 0x01) == (QR_DATA[k*SIZE + i] & 0x01))
-                {
-                    count++;
-                }
-                else
-                {
-                    break;
-                }
-            }
+    plane.resize(SIZE);
 
-            if (count >= 5)
-            {
-                score += (count - 5) + 3;
-            }
+    for (int i = 0; i < SIZE; i++)
+    {
+        const uint64_t *mask_row = pattern.row(i % 12);
+        const uint64_t *function_row = FUNCTION_PLANE.row(i);
+        uint64_t *row = plane.row(i);
 
-            j = k - 1;
+        for (int w = 0; w < plane.words; w++)
+        {
+            row[w] = mask_row[w] & ~function_row[w];
         }
     }
+}
+
+/* Apply (or undo) a data mask: XOR with its mask plane */
+void QR::data_mask_pattern(const BIT_MATRIX &plane)
+{
+    for (unsigned int i = 0; i < DARK_PLANE.bits.size(); i++)
+    {
+        DARK_PLANE.bits[i] ^= plane.bits[i];
+    }
+}
+
+/* Divide the data sequence into blocks as defined according to the version and error correction level
+ * For each data block, calculate a corresponding block of error correction codewords
+ * Assemble the final sequence by taking data and error correction codewords from each block in turn
+ * Each codeword is written straight into its modules through the placement table */
+void QR::data_pattern(const vector<unsigned char> &data, const vector<unsigned char> &ec)
+{
+    EC_INFO info1 = QR_info[VERSION - 1].ec_info[0][EC_LEVEL];
+    EC_INFO info2 = QR_info[VERSION - 1].ec_info[1][EC_LEVEL];
+    int blocks = info1.blocks + info2.blocks;
+    int data_bytes = (info1.block_data_bytes < info2.block_data_bytes) ? info2.block_data_bytes : info1.block_data_bytes;
+    int ec_bytes = info1.block_bytes - info1.block_data_bytes;
+    const unsigned short *module = &TEMPLATE->placement[0];
 
-    /* Block of modules in same color: penalty socre N2 = 3 */
-    for (i = 0; i < SIZE - 1; i++)
+    for (int i = 0; i < data_bytes; i++)
     {
-        for (j = 0; j < SIZE - 1; j++)
+        int index = i;
+        for (int j = 0; j < blocks; j++)
         {
-            if ((QR_DATA[i*SIZE + j] & 0x01) == (QR_DATA[i*SIZE + j + 1] & 0x01)
-                && (QR_DATA[i*SIZE + j] & 0x01) == (QR_DATA[(i + 1)*SIZE + j] & 0x01)
-                && (QR_DATA[i*SIZE + j] & 0x01) == (QR_DATA[(i + 1)*SIZE + j + 1] & 0x01))
+            int len = (j < info1.blocks) ? info1.block_data_bytes : info2.block_data_bytes;
+
+            if (i < len)
             {
-                score += 3;
+                place_codeword(module, data[index]);
+                module += 8;
             }
+            index += len;
         }
     }
 
-    /* 1:1:3:1:1 ratio pattern: penalty socre N3 = 40 */
-    for (i = 0; i < SIZE; i++)
+    for (int i = 0; i < ec_bytes; i++)
     {
-        for (j = 0; j < SIZE - 6; j++)
+        for (int j = 0; j < blocks; j++)
         {
-            /* Row */
-            if ((QR_DATA[i*SIZE + j] & 0x01) == 1
-                && (QR_DATA[i*SIZE + j + 1] & 0x01) == 0
-                && (QR_DATA[i*SIZE + j + 2] & 0x01) == 1
-                && (QR_DATA[i*SIZE + j + 3] & 0x01) == 1
-                && (QR_DATA[i*SIZE + j + 4] & 0x01) == 1
-                && (QR_DATA[i*SIZE + j + 5] & 0x01) == 0
-                && (QR_DATA[i*SIZE + j + 6] & 0x01) == 1)
-            {
-                if (is_light_row(i, j - 4) || is_light_row(i, j + 7))
-                {
-                    score += 40;
-                }
-            }
-            /* Column */
-            if ((QR_DATA[j*SIZE + i] & 0x01) == 1
-                && (QR_DATA[(j + 1)*SIZE + i] & 0x01) == 0
-                && (QR_DATA[(j + 2)*SIZE + i] & 0x01) == 1
-                && (QR_DATA[(j + 3)*SIZE + i] & 0x01) == 1
-                && (QR_DATA[(j + 4)*SIZE + i] & 0x01) == 1
-                && (QR_DATA[(j + 5)*SIZE + i] & 0x01) == 0
-                && (QR_DATA[(j + 6)*SIZE + i] & 0x01) == 1)
-            {
-                if (is_light_col(i, j - 4) || is_light_col(i, j + 7))
-                {
-                    score += 40;
-                }
-            }
+            place_codeword(module, ec[j*ec_bytes + i]);
+            module += 8;
         }
     }
+}
 
-    /* Proportion of dark modules in entire symbol: penalty socre N4 = 10 */
-    int count = 0;
-    for (i = 0; i < SIZE; i++)
+/* Set the dark modules of a codeword, module[0] is its most significant bit */
+void QR::place_codeword(const unsigned short *module, unsigned char codeword)
+{
+    for (int i = 0; i < 8; i++)
     {
-        for (j = 0; j < SIZE; j++)
+        if (codeword & (0x80 >> i))
         {
-            if (QR_DATA[i*SIZE + j] & 0x01)
-            {
-                count++;
-            }
+            DARK_PLANE.bits[module[i] >> 6] |= (1ULL << (63 - (module[i] & 0x3F)));
         }
     }
+}
+
+vector<unsigned char> QR::encode_data(string content)
+{
+    BIT_BUFFER bits(QR_info[VERSION - 1].data_bytes[EC_LEVEL]);
 
-    int ratio = abs(50 - (count*100)/(SIZE*SIZE))/5;
-    score += 10*ratio;
+    eci_header(bits, MODE, ENCODING);
+    for (unsigned int i = 0; i < SEGMENTS.size(); i++)
+    {
+        const SEGMENT &segment = SEGMENTS[i];
+
+        mode_indicator(bits, segment.mode);
+        character_count(bits, segment.length, segment.mode, VERSION);
+        encode_content(bits, content.substr(segment.start, segment.length), segment.mode);
+    }
+    terminator(bits, VERSION, EC_LEVEL);
+    padding_bits(bits);
+    padding_codewords(bits, VERSION, EC_LEVEL);
 
-    return score;
+    return bits.data();
 }
 
-/* 1. Data masking is not applied to function patterns.
- * 2. Data masking is performed on the encoding region (excluding format information and version information)
- * 3. Although the data masking is performed on encoding region, the area to be evaluated is the complete symbol.
- * 4. Select the pattern with the lowest penalty points score. */
-int QR::data_mask_evaluation()
+/* Function patterns, format information area and version information of the version
+ * Built once per version on first use, every symbol of the version starts as a copy */
+const VERSION_TEMPLATE &QR::version_template(int version)
 {
-    int data_mask = 0;
-    int min_penalty = 0xFFFF;
+    static VERSION_TEMPLATE templates[QR_MAX_VERSION];
+    static std::once_flag built[QR_MAX_VERSION];
 
-    for (int i = 0; i < 8; i++)
+    std::call_once(built[version - 1], [version]()
     {
-        format_info(i);
-        data_mask_pattern(i);
+        QR qr;
+
+        qr.VERSION = version;
+        qr.SIZE = QR_MIN_SIZE + (version - 1)*4;
+        qr.DARK_PLANE.resize(qr.SIZE);
+        qr.FUNCTION_PLANE.resize(qr.SIZE);
 
-        int penalty = data_mask_score();
+        qr.finder_pattern(0, 0);
+        qr.finder_pattern(0, qr.SIZE - FINDER_PATTERN_SIZE);
+        qr.finder_pattern(qr.SIZE - FINDER_PATTERN_SIZE, 0);
+        qr.separator();
+        qr.align_pattern();
+        qr.timing_pattern();
 
-        if (penalty < min_penalty)
+        /* Reserve the format information area */
+        format_modules(0x7FFF, qr.SIZE, qr.FUNCTION_PLANE);
+        qr.version_info();
+
+        VERSION_TEMPLATE &t = templates[version - 1];
+        qr.placement_table(t.placement);
+
+        for (int i = 0; i < 8; i++)
         {
-            min_penalty = penalty;
-            data_mask = i;
+            qr.data_mask_plane(i, t.mask[i]);
         }
 
-        data_mask_pattern(i);
-    }
+        std::swap(t.dark, qr.DARK_PLANE);
+        std::swap(t.function, qr.FUNCTION_PLANE);
+    });
 
-    return data_mask;
+    return templates[version - 1];
 }
 
-void QR::data_mask_pattern(int data_mask)
+/* Templates of the reference payload, from the cache of the last EC_TEMPLATE_CACHE references
+ * A dropped reference is built again on its next use, callers still holding it keep it alive until they are done. */
+std::shared_ptr<EC_TEMPLATE> QR::ec_template(const string &reference, bool mixed_mode)
 {
-    for (int i = 0; i < SIZE; i++)
+    typedef std::pair<std::pair<string, bool>, std::shared_ptr<EC_TEMPLATE> > ENTRY;
+
+    /* Most recently used first, at most EC_TEMPLATE_CACHE entries */
+    static std::mutex lock;
+    static std::list<ENTRY> templates;
+
+    std::lock_guard<std::mutex> guard(lock);
+    std::pair<string, bool> key(reference, mixed_mode);
+    std::list<ENTRY>::iterator it = templates.begin();
+
+    while (it != templates.end() && it->first != key)
     {
-        for (int j = 0; j < SIZE; j++)
-        {
-            bool mask;
+        it++;
+    }
 
-            if (QR_DATA[i*SIZE + j] & MODULE_FUNCION_PATTERN)
-            {
-                continue;
-            }
+    if (it != templates.end())
+    {
+        templates.splice(templates.begin(), templates, it);
+    }
+    else
+    {
+        std::shared_ptr<EC_TEMPLATE> t = std::make_shared<EC_TEMPLATE>();
 
-            switch(data_mask)
-            {
-                case 0:
-                    mask = ((i + j) % 2 == 0);
-                break;
+        t->reference = reference;
+        t->mixed_mode = mixed_mode;
+        templates.push_front(ENTRY(key, t));
+
+        if (templates.size() > EC_TEMPLATE_CACHE)
+        {
+            templates.pop_back();
+        }
+    }
 
-                case 1:
-                    mask = (i % 2 == 0);
-                break;
+    return templates.front().second;
+}
 
-                case 2:
-                    mask = (j % 3 == 0);
-                break;
+/* Parity templates of each block of the reference at version and ec_level, NULL if it does not fit
+ * Built on first use, without the cache lock. */
+std::shared_ptr<const vector<RS_TEMPLATE> > QR::ec_blocks(const std::shared_ptr<EC_TEMPLATE> &t, int version, int ec_level)
+{
+    vector<RS_TEMPLATE> &blocks = t->blocks[version - 1][ec_level];
 
-                case 3:
-                    mask = ((i + j) % 3 == 0);
-                break;
+    std::call_once(t->built[version - 1][ec_level], [&]()
+    {
+        QR qr;
 
-                case 4:
-                    mask = (((i / 2) + (j / 3)) % 2 == 0);
-                break;
+        qr.EC_LEVEL = ec_level;
+
+        if (qr.select_segments(t->reference, version, t->mixed_mode) != QR_OK)
+        {
+            return;
+        }
 
-                case 5:
-                    mask = (((i * j) % 2) + ((i * j) % 3) == 0);
-                break;
+        vector<unsigned char> data = qr.encode_data(t->reference);
+        int data_pos = 0;
 
-                case 6:
-                    mask = ((((i * j) % 2) + ((i * j) % 3)) % 2 == 0);
-                break;
+        for (int i = 0; i <= 1; i++)
+        {
+            EC_INFO info = QR_info[version - 1].ec_info[i][ec_level];
 
-                case 7:
-                    mask = ((((i + j) % 2) + ((i * j) % 3)) % 2 == 0);
-                break;
+            for (int j = 0; j < info.blocks; j++)
+            {
+                blocks.push_back(RS_TEMPLATE(&data[data_pos], info.block_data_bytes, info.block_bytes - info.block_data_bytes));
+                data_pos += info.block_data_bytes;
             }
-
-            QR_DATA[i*SIZE + j] ^= mask;
         }
-    }
+    });
+
+    /* Shares ownership of the whole template */
+    return blocks.empty() ? std::shared_ptr<const vector<RS_TEMPLATE> >() : std::shared_ptr<const vector<RS_TEMPLATE> >(t, &blocks);
 }
 
-/* Divide the data sequence into blocks as defined according to the version and error correction level
- * For each data block, calculate a corresponding block of error correction codewords
- * Assemble the final sequence by taking data and error correction codewords from each block in turn */
-string QR::construct_data(string qr_str, string ec_str)
+/* Determine encoding, segments and version (fixed or AUTO_VERSION) of content at EC_LEVEL */
+int QR::select_segments(const string &content, int version, bool mixed_mode)
 {
-    string ret = "";
-    EC_INFO info1 = QR_info[VERSION - 1].ec_info[0][EC_LEVEL];
-    EC_INFO info2 = QR_info[VERSION - 1].ec_info[1][EC_LEVEL];
-    int data_bytes = (info1.block_data_bytes < info2.block_data_bytes) ? info2.block_data_bytes : info1.block_data_bytes;
+    vector<int> boundaries;
+    CONTENT_CLASS info = classify_content(content, mixed_mode ? &boundaries : NULL);
 
-    for (int i = 0; i < data_bytes; i++)
+    ENCODING = info.encoding;
+
+    if (!mixed_mode)
     {
-        int index = i;
-        for (int j = 0; j < info1.blocks + info2.blocks; j++)
+        MODE = info.mode;
+
+        /* Invalid mode */
+        if (MODE < 0)
         {
-            int len = (j < info1.blocks) ? info1.block_data_bytes : info2.block_data_bytes;
+            return QR_ERROR_CONTENT;
+        }
+
+        VERSION = version_check(content, EC_LEVEL, version, MODE, ENCODING);
+
+        SEGMENTS.resize(1);
+        SEGMENTS[0].mode = MODE;
+        SEGMENTS[0].start = 0;
+        SEGMENTS[0].length = content.size();
+    }
+    else
+    {
+        int min_ver = QR_MIN_VERSION, max_ver = QR_MAX_VERSION;
+        int bits = 0;
+
+        if (AUTO_VERSION != version)
+        {
+            min_ver = max_ver = version;
+        }
 
-            if (j < info1.blocks && i >= info1.block_data_bytes)
+        /* Versions with the same character count indicator lengths */
+        static const int groups[3][2] = {{1, 9}, {10, 26}, {27, 40}};
+
+        VERSION = -1;
+        for (int g = 0; g < 3 && VERSION < 0; g++)
+        {
+            int lo = (groups[g][0] > min_ver) ? groups[g][0] : min_ver;
+            int hi = (groups[g][1] < max_ver) ? groups[g][1] : max_ver;
+
+            if (lo > hi)
             {
-                index += len;
+                continue;
             }
-            else
+
+            bits = segment_content(content, boundaries, lo, ENCODING, SEGMENTS);
+
+            /* Empty content */
+            if (bits < 0)
+            {
+                return QR_ERROR_CONTENT;
+            }
+
+            /* Smallest version of the group that holds the segments */
+            while (lo < hi)
+            {
+                int mid = (lo + hi)/2;
+
+                if (bits <= QR_info[mid - 1].data_bytes[EC_LEVEL]*8)
+                {
+                    hi = mid;
+                }
+                else
+                {
+                    lo = mid + 1;
+                }
+            }
+
+            if (bits <= QR_info[lo - 1].data_bytes[EC_LEVEL]*8)
             {
-                ret += qr_str.substr(index*8, 8);
-                index += len;
+                VERSION = lo;
             }
         }
-    }
 
-    for (int i = 0; i < info1.block_bytes - info1.block_data_bytes; i++)
-    {
-        int index = i;
-        for (int j = 0; j < info1.blocks + info2.blocks; j++)
+        MODE = NUMERIC;
+        for (unsigned int i = 0; i < SEGMENTS.size(); i++)
         {
-            ret += ec_str.substr(index*8, 8);
-            index += (info1.block_bytes - info1.block_data_bytes);
+            MODE = (SEGMENTS[i].mode > MODE) ? SEGMENTS[i].mode : MODE;
         }
     }
 
-    return ret;
+    /* Invalid version */
+    if (VERSION < QR_MIN_VERSION)
+    {
+        return QR_ERROR_CAPACITY;
+    }
+
+    return QR_OK;
 }
 
-string QR::encode_data(string content)
+/* Error correction level and version (fixed or AUTO_VERSION) in range */
+static bool valid_parameters(int ec_level, int version)
 {
-    string data_str = "", ec_str;
-
-    data_str += eci_header(MODE, ENCODING);
-    data_str += mode_indicator(MODE);
-    data_str += character_count(content.size(), MODE, VERSION);
-    data_str += encode_content(content, MODE);
-    data_str += terminator(data_str.size(), VERSION, EC_LEVEL);
-    data_str += padding_bits(data_str.size());
-    data_str += padding_codewords(data_str.size(), VERSION, EC_LEVEL);
-    ec_str = error_correction(data_str, VERSION, EC_LEVEL);
+    if (ec_level < LEVEL_L || ec_level > LEVEL_H)
+    {
+        return false;
+    }
 
-    return construct_data(data_str, ec_str);
+    return (AUTO_VERSION == version || (version >= QR_MIN_VERSION && version <= QR_MAX_VERSION));
 }
 
-QR::QR(string content, char *path, int ec_level, int version)
+/* Check the options, determine mode and version, and encode the data codewords */
+int QR::prepare(string content, const QR_OPTIONS &options)
 {
-    EC_LEVEL = ec_level;
-    MODE = mode_check(content);
-    ENCODING = encoding_check(content);
-    VERSION = version_check(content, ec_level, version, MODE, ENCODING);
+    if (!valid_parameters(options.ec_level, options.version))
+    {
+        return QR_ERROR_PARAMETER;
+    }
+
+    EC_LEVEL = options.ec_level;
+
+    int error = select_segments(content, options.version, options.mixed_mode);
 
-    /* Invalid mode or version */
-    if (VERSION < QR_MIN_VERSION || MODE < 0)
+    if (error != QR_OK)
     {
-        return;
+        return error;
     }
 
     SIZE = QR_MIN_SIZE + (VERSION - 1)*4;
+    DATA_CODEWORDS = encode_data(content);
+    EC_CODEWORDS.resize(QR_info[VERSION - 1].total_bytes - QR_info[VERSION - 1].data_bytes[EC_LEVEL]);
 
-    QR_DATA = new unsigned char[SIZE*SIZE];
-    memset(QR_DATA, MODULE_NOT_SET, SIZE*SIZE);
+    return QR_OK;
+}
 
+/* Place the codewords and select the data mask, once EC_CODEWORDS are calculated */
+void QR::finish(const QR_OPTIONS &options)
+{
     /* Function patterns */
-    finder_pattern(0, 0);
-    finder_pattern(0, SIZE - FINDER_PATTERN_SIZE);
-    finder_pattern(SIZE - FINDER_PATTERN_SIZE, 0);
-    separator();
-    align_pattern();
-    timing_pattern();
+    TEMPLATE = &version_template(VERSION);
+    DARK_PLANE = TEMPLATE->dark;
+    FUNCTION_PLANE = TEMPLATE->function;
 
     /* Encoding region */
-    format_info(0);
-    version_info();
-    string bit_stream = encode_data(content);
-    data_pattern(bit_stream);
+    data_pattern(DATA_CODEWORDS, EC_CODEWORDS);
 
-    int data_mask = data_mask_evaluation();
-    data_mask_pattern(data_mask);
-    format_info(data_mask);
+    DATA_MASK = data_mask_evaluation(options);
 
-    for (int i = 0; i < SIZE; i++)
+    data_mask_pattern(TEMPLATE->mask[DATA_MASK]);
+    format_info(DATA_MASK, DARK_PLANE);
+}
+
+int QR::build(string content, const QR_OPTIONS &options, const std::shared_ptr<EC_TEMPLATE> &reference)
+{
+    int error = prepare(content, options);
+
+    if (QR_OK == error)
     {
-        for (int j = 0; j < SIZE; j++)
+        std::shared_ptr<const vector<RS_TEMPLATE> > blocks;
+
+        if (reference)
+        {
+            blocks = ec_blocks(reference, VERSION, EC_LEVEL);
+        }
+
+        if (options.ec_executor)
+        {
+            error_correction(DATA_CODEWORDS, EC_CODEWORDS, VERSION, EC_LEVEL, blocks.get(), options.ec_executor);
+        }
+        else if (blocks)
+        {
+            error_correction(DATA_CODEWORDS, EC_CODEWORDS, VERSION, EC_LEVEL, *blocks);
+        }
+        else
+        {
+            error_correction(DATA_CODEWORDS, EC_CODEWORDS, VERSION, EC_LEVEL);
+        }
+        finish(options);
+    }
+
+    return error;
+}
+
+void QR::to_symbol(QR_SYMBOL &symbol)
+{
+    symbol.version = VERSION;
+    symbol.size = SIZE;
+    symbol.ec_level = EC_LEVEL;
+    symbol.mask = DATA_MASK;
+    symbol.mode = MODE;
+    symbol.encoding = ENCODING;
+    std::swap(symbol.modules, DARK_PLANE);
+}
+
+int QR::capacity(int version, int ec_level, int mode, int encoding)
+{
+    if (!valid_parameters(ec_level, version) || AUTO_VERSION == version
+        || mode < NUMERIC || mode >= MAX_MODE || (encoding != ISO_8859_1 && encoding != UTF_8))
+    {
+        return -1;
+    }
+
+    return capacity_table().chars[encoding][mode][ec_level][version - 1];
+}
+
+int QR::fit(const string &content, const QR_OPTIONS &options, int *version)
+{
+    QR qr;
+
+    if (!valid_parameters(options.ec_level, options.version))
+    {
+        return QR_ERROR_PARAMETER;
+    }
+
+    qr.EC_LEVEL = options.ec_level;
+
+    int error = qr.select_segments(content, options.version, options.mixed_mode);
+
+    if (QR_OK == error && version)
+    {
+        *version = qr.VERSION;
+    }
+
+    return error;
+}
+
+QR_SYMBOL QR::encode(string content, int ec_level, int version)
+{
+    QR_OPTIONS options;
+
+    options.ec_level = ec_level;
+    options.version = version;
+
+    return encode(content, options);
+}
+
+QR_SYMBOL QR::encode(string content, const QR_OPTIONS &options)
+{
+    QR qr;
+    QR_SYMBOL symbol;
+    std::shared_ptr<EC_TEMPLATE> reference;
+
+    if (!options.ec_template.empty())
+    {
+        reference = ec_template(options.ec_template, options.mixed_mode);
+    }
+
+    symbol.error = qr.build(content, options, reference);
+
+    if (QR_OK == symbol.error)
+    {
+        qr.to_symbol(symbol);
+    }
+
+    return symbol;
+}
+
+vector<QR_SYMBOL> QR::encode_batch(const vector<string> &payloads, const QR_OPTIONS &options)
+{
+    int count = payloads.size();
+    vector<QR_SYMBOL> symbols(count);
+
+    /* Symbols already run on the batch workers, more threads per symbol would only oversubscribe them */
+    QR_OPTIONS symbol_options = options;
+
+    if (1 != options.threads)
+    {
+        symbol_options.mask_threads = 1;
+    }
+
+    /* Looked up once, the cache lock would serialise the workers */
+    std::shared_ptr<EC_TEMPLATE> reference;
+
+    if (!options.ec_template.empty())
+    {
+        reference = ec_template(options.ec_template, options.mixed_mode);
+    }
+
+    if (!options.batch_ec)
+    {
+        parallel_for(count, options.threads, [&](int i)
+        {
+            try
+            {
+                QR qr;
+
+                symbols[i].error = qr.build(payloads[i], symbol_options, reference);
+
+                if (QR_OK == symbols[i].error)
+                {
+                    qr.to_symbol(symbols[i]);
+                }
+            }
+            catch (...)
+            {
+                symbols[i] = QR_SYMBOL();
+                symbols[i].error = QR_ERROR_INTERNAL;
+            }
+        });
+
+        return symbols;
+    }
+
+    /* 1. Data codewords of every payload */
+    vector<QR> encoders(count, QR());
+
+    parallel_for(count, options.threads, [&](int i)
+    {
+        try
+        {
+            symbols[i].error = encoders[i].prepare(payloads[i], symbol_options);
+        }
+        catch (...)
+        {
+            symbols[i].error = QR_ERROR_INTERNAL;
+        }
+    });
+
+    /* 2. Error correction codewords, RS_LANES payloads of the same version and level at a time */
+    vector<int> order;
+    for (int i = 0; i < count; i++)
+    {
+        if (QR_OK == symbols[i].error)
+        {
+            order.push_back(i);
+        }
+    }
+
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b)
+    {
+        return (encoders[a].VERSION*QR_EC_LEVEL + encoders[a].EC_LEVEL) < (encoders[b].VERSION*QR_EC_LEVEL + encoders[b].EC_LEVEL);
+    });
+
+    /* Group g is order[groups[g]] ~ order[groups[g + 1] - 1] */
+    vector<int> groups;
+    for (unsigned int i = 0; i < order.size(); i++)
+    {
+        if (i == 0 || (int)i - groups.back() == RS_LANES
+            || encoders[order[i]].VERSION != encoders[order[groups.back()]].VERSION
+            || encoders[order[i]].EC_LEVEL != encoders[order[groups.back()]].EC_LEVEL)
         {
-            QR_DATA[i*SIZE + j] &= 0x01;
+            groups.push_back(i);
         }
     }
+    groups.push_back(order.size());
+
+    parallel_for(groups.size() - 1, options.threads, [&](int g)
+    {
+        try
+        {
+            const QR &first = encoders[order[groups[g]]];
+            std::shared_ptr<const vector<RS_TEMPLATE> > blocks;
+
+            if (reference)
+            {
+                blocks = ec_blocks(reference, first.VERSION, first.EC_LEVEL);
+            }
+
+            /* Only the codewords that differ from the reference cost work, no need to interleave */
+            if (blocks)
+            {
+                for (int i = groups[g]; i < groups[g + 1]; i++)
+                {
+                    QR &qr = encoders[order[i]];
+                    error_correction(qr.DATA_CODEWORDS, qr.EC_CODEWORDS, qr.VERSION, qr.EC_LEVEL, *blocks);
+                }
+                return;
+            }
+
+            vector<const unsigned char *> data;
+            vector<unsigned char *> ec;
+
+            for (int i = groups[g]; i < groups[g + 1]; i++)
+            {
+                data.push_back(&encoders[order[i]].DATA_CODEWORDS[0]);
+                ec.push_back(&encoders[order[i]].EC_CODEWORDS[0]);
+            }
+
+            error_correction(data, ec, first.VERSION, first.EC_LEVEL);
+        }
+        catch (...)
+        {
+            /* The whole group, its codewords may be partly written */
+            for (int i = groups[g]; i < groups[g + 1]; i++)
+            {
+                symbols[order[i]].error = QR_ERROR_INTERNAL;
+            }
+        }
+    });
+
+    /* 3. Codeword placement and data masking */
+    parallel_for(count, options.threads, [&](int i)
+    {
+        if (QR_OK != symbols[i].error)
+        {
+            return;
+        }
+
+        try
+        {
+            encoders[i].finish(symbol_options);
+            encoders[i].to_symbol(symbols[i]);
+        }
+        catch (...)
+        {
+            symbols[i] = QR_SYMBOL();
+            symbols[i].error = QR_ERROR_INTERNAL;
+        }
+
+        /* Release the codewords early */
+        encoders[i] = QR();
+    });
+
+    return symbols;
+}
+
+QR::QR()
+{
+    VERSION = 0;
+    MODE = -1;
+    SIZE = 0;
+    EC_LEVEL = LEVEL_M;
+    ENCODING = ISO_8859_1;
+    DATA_MASK = 0;
+    TEMPLATE = NULL;
+}
+
+QR_OPTIONS::QR_OPTIONS()
+{
+    ec_level = LEVEL_M;
+    version = AUTO_VERSION;
+    threads = 0;
+    mask_threads = 1;
+    mask_early_exit = true;
+    batch_ec = true;
+    mixed_mode = false;
+}
+
+QR::QR(string content, char *path, int ec_level, int version, int scale, int quiet_zone)
+{
+    QR_SYMBOL symbol = encode(content, ec_level, version);
 
     /* Create QR code png file */
-    PNG qr_png;
-    qr_png.set_ihdr(SIZE, SIZE, BIT_DEPTH_1, INDEXED_COLOR);
+    render_png(symbol, path, scale, quiet_zone);
+}
 
-    PIXEL pixels[] = {{0xFF, 0xFF, 0xFF}, {0, 0, 0}};
-    qr_png.set_plte(pixels, 2);
+QR_SYMBOL::QR_SYMBOL()
+{
+    version = 0;
+    size = 0;
+    ec_level = LEVEL_M;
+    mask = 0;
+    mode = -1;
+    encoding = ISO_8859_1;
+    error = QR_ERROR_CONTENT;
+}
 
-    qr_png.set_idat((unsigned char *)QR_DATA);
-    qr_png.write(path);
+bool QR_SYMBOL::valid() const
+{
+    return (QR_OK == error);
+}
 
-    delete [] QR_DATA;
-}
\ No newline at end of file
+bool QR_SYMBOL::module(int x, int y) const
+{
+    return modules.get(x, y);
+}
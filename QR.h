@@ -4,8 +4,13 @@
 #ifndef _QR_H_
 #define _QR_H_
 
+#include <memory>
 #include <string>
+#include <vector>
+#include "matrix.h"
+#include "scheduler.h"
 using std::string;
+using std::vector;
 
 /* Determine version automatically */
 #define AUTO_VERSION    (-1)
@@ -47,6 +52,90 @@ enum
     UTF_8 = 1
 };
 
+/* Encoding result */
+enum
+{
+    QR_OK = 0,
+    /* Invalid error correction level or version */
+    QR_ERROR_PARAMETER = 1,
+    /* Content can not be encoded (eg: empty) */
+    QR_ERROR_CONTENT = 2,
+    /* Content does not fit in the version */
+    QR_ERROR_CAPACITY = 3,
+    /* Out of memory or other failure */
+    QR_ERROR_INTERNAL = 4
+};
+
+/* Encoding options */
+class QR_OPTIONS
+{
+public:
+    int ec_level;
+    /* Fixed version (1~40) or AUTO_VERSION */
+    int version;
+    /* Worker threads of encode_batch, 0: one per hardware thread */
+    int threads;
+    /* Threads scoring the 8 data mask candidates of a symbol, 1: serial; 0: one per hardware thread
+     * Versions below 15 are always scored serially, their candidates cost less than handing them to threads.
+     * encode_batch scores serially unless threads is 1, the batch workers already keep the cores busy */
+    int mask_threads;
+    /* Stop scoring a data mask candidate once its penalty exceeds the best one so far */
+    bool mask_early_exit;
+    /* encode_batch: calculate error correction codewords of payloads with the same version and level together */
+    bool batch_ec;
+    /* Reference payload sharing most codewords with the content (eg: URL prefix + fixed length ID), empty: none
+     * Error correction is computed from the reference parity and the codewords that differ from it.
+     * Templates are built on first use and cached for the last few references (a handful of fixed prefixes, not one per payload). */
+    string ec_template;
+    /* Split content into NUMERIC / ALPHA_NUMERIC / BYTE / KANJI segments with the fewest bits (smallest version)
+     * instead of one mode for the whole content */
+    bool mixed_mode;
+    /* Runs the error correction blocks of a symbol concurrently (eg: one large symbol at a time), empty: serial */
+    EXECUTOR ec_executor;
+
+    QR_OPTIONS();
+};
+
+/* Encoded symbol: module matrix and the parameters it was encoded with */
+class QR_SYMBOL
+{
+public:
+    int version;
+    /* Modules per side */
+    int size;
+    int ec_level;
+    /* Data mask pattern reference (0~7) */
+    int mask;
+    /* Data mode, the widest mode of all segments with mixed_mode */
+    int mode;
+    int encoding;
+    /* QR_OK, or why the content could not be encoded */
+    int error;
+    /* size*size modules, set bits are dark */
+    BIT_MATRIX modules;
+
+    QR_SYMBOL();
+
+    /* False if the content could not be encoded */
+    bool valid() const;
+
+    /* Module at row x, column y is dark */
+    bool module(int x, int y) const;
+};
+
+/* Part of the content encoded in one mode */
+typedef struct
+{
+    int mode;
+    /* Bytes of content */
+    int start;
+    int length;
+}SEGMENT;
+
+class VERSION_TEMPLATE;
+class RS_TEMPLATE;
+class EC_TEMPLATE;
+
 class QR
 {
 private:
@@ -55,30 +144,68 @@ private:
     int SIZE;
     int EC_LEVEL;
     int ENCODING;
-    unsigned char *QR_DATA;
+    int DATA_MASK;
+    /* Module colors: set bits are dark */
+    BIT_MATRIX DARK_PLANE;
+    /* Set bits are function pattern modules (not masked) */
+    BIT_MATRIX FUNCTION_PLANE;
+    /* Prebuilt planes of VERSION */
+    const VERSION_TEMPLATE *TEMPLATE;
+    vector<SEGMENT> SEGMENTS;
+    vector<unsigned char> DATA_CODEWORDS;
+    vector<unsigned char> EC_CODEWORDS;
 
 private:
+    void function_module(int x, int y, int value);
     void finder_pattern(int x, int y);
     void separator();
     void timing_pattern();
     void align_pattern();
 
-    string encode_data(string content);
-    string construct_data(string qr_str, string ec_str);
+    vector<unsigned char> encode_data(string content);
 
-    void format_info(int data_mask);
+    void format_info(int data_mask, BIT_MATRIX &plane);
     void version_info();
-    void data_pattern(string qr_str);
+    void placement_table(vector<unsigned short> &table);
+    void data_pattern(const vector<unsigned char> &data, const vector<unsigned char> &ec);
+    void place_codeword(const unsigned short *module, unsigned char codeword);
+
+    int data_mask_evaluation(const QR_OPTIONS &options);
+    void data_mask_plane(int data_mask, BIT_MATRIX &plane);
+    void data_mask_pattern(const BIT_MATRIX &plane);
 
-    int data_mask_score();
-    int data_mask_evaluation();
-    void data_mask_pattern(int data_mask);
+    static const VERSION_TEMPLATE &version_template(int version);
+    /* Templates of a reference payload, the last EC_TEMPLATE_CACHE references are kept */
+    static std::shared_ptr<EC_TEMPLATE> ec_template(const string &reference, bool mixed_mode);
+    /* Parity templates of each block of the reference, NULL if it does not fit in the version
+     * The returned pointer keeps the whole template alive. */
+    static std::shared_ptr<const vector<RS_TEMPLATE> > ec_blocks(const std::shared_ptr<EC_TEMPLATE> &t, int version, int ec_level);
+    int select_segments(const string &content, int version, bool mixed_mode);
+    int prepare(string content, const QR_OPTIONS &options);
+    void finish(const QR_OPTIONS &options);
+    /* reference: templates of options.ec_template, NULL for none */
+    int build(string content, const QR_OPTIONS &options, const std::shared_ptr<EC_TEMPLATE> &reference);
+    void to_symbol(QR_SYMBOL &symbol);
 
-    bool is_light_row(int row, int start_col);
-    bool is_light_col(int col, int start_row);
+    QR();
 
 public:
-    QR(string content, char *path, int ec_level = LEVEL_M, int version = AUTO_VERSION);
+    /* Encode content to a symbol, without any output */
+    static QR_SYMBOL encode(string content, int ec_level = LEVEL_M, int version = AUTO_VERSION);
+    static QR_SYMBOL encode(string content, const QR_OPTIONS &options);
+
+    /* Max characters of mode (KANJI: double-byte characters) in a version at ec_level, -1 if a parameter is invalid */
+    static int capacity(int version, int ec_level, int mode, int encoding = ISO_8859_1);
+
+    /* Check whether content fits without encoding it (eg: admission control before queuing work)
+     * Returns the QR_OK / QR_ERROR_* that encode would report, and the version it would use */
+    static int fit(const string &content, const QR_OPTIONS &options, int *version = NULL);
+
+    /* Encode all payloads on a pool of worker threads, symbols are returned in input order */
+    static vector<QR_SYMBOL> encode_batch(const vector<string> &payloads, const QR_OPTIONS &options);
+
+    /* Encode content and save it as png file to the path, scale*scale pixels per module and quiet_zone light modules around */
+    QR(string content, char *path, int ec_level = LEVEL_M, int version = AUTO_VERSION, int scale = 1, int quiet_zone = 0);
 };
 
 #endif /* _QR_H_ */
\ No newline at end of file
@@ -0,0 +1,424 @@
+#include "classify.h"
+#include "simd.h"
+#include <stdint.h>
+#include <string.h>
+
+const signed char ALPHA_NUMERIC_VALUE[256] =
+{
+     -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,
+     -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,
+     36,  -1,  -1,  -1,  37,  38,  -1,  -1,  -1,  -1,  39,  40,  -1,  41,  42,  43,
+      0,   1,   2,   3,   4,   5,   6,   7,   8,   9,  44,  -1,  -1,  -1,  -1,  -1,
+     -1,  10,  11,  12,  13,  14,  15,  16,  17,  18,  19,  20,  21,  22,  23,  24,
+     25,  26,  27,  28,  29,  30,  31,  32,  33,  34,  35,  -1,  -1,  -1,  -1,  -1,
+     -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,
+     -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,
+     -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,
+     -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,
+     -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,
+     -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,
+     -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,
+     -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,
+     -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,
+     -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1
+};
+
+/* Check Shift JIS characters */
+static bool is_kanji(const string &content)
+{
+    int data_len = content.size();
+
+    if (data_len % 2)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < data_len; i+=2)
+    {
+        unsigned char c = content[i];
+        if ((c < 0x81 || c > 0x9F) && (c < 0xE0 || c > 0xEB))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* Strict UTF-8 (RFC 3629): shortest form, no surrogates, at most U+10FFFF
+ * 1-byte 00~7F
+ * 2-byte C2~DF 80~BF
+ * 3-byte E0 A0~BF 80~BF | E1~EC 80~BF 80~BF | ED 80~9F 80~BF | EE~EF 80~BF 80~BF
+ * 4-byte F0 90~BF 80~BF 80~BF | F1~F3 80~BF 80~BF 80~BF | F4 80~8F 80~BF 80~BF */
+static bool utf8_valid_scalar(const unsigned char *p, int n)
+{
+    int i = 0;
+
+    while (i < n)
+    {
+        /* 8 ASCII bytes at a time */
+        if (i + 8 <= n)
+        {
+            uint64_t word;
+            memcpy(&word, p + i, 8);
+
+            if (0 == (word & 0x8080808080808080ULL))
+            {
+                i += 8;
+                continue;
+            }
+        }
+
+        unsigned char c = p[i];
+        int follow = 0;
+        unsigned char low = 0x80, high = 0xBF;
+
+        if (c < 0x80)
+        {
+            i++;
+            continue;
+        }
+        else if (c >= 0xC2 && c <= 0xDF)
+        {
+            follow = 1;
+        }
+        else if (c >= 0xE0 && c <= 0xEF)
+        {
+            follow = 2;
+            low = (0xE0 == c) ? 0xA0 : 0x80;
+            high = (0xED == c) ? 0x9F : 0xBF;
+        }
+        else if (c >= 0xF0 && c <= 0xF4)
+        {
+            follow = 3;
+            low = (0xF0 == c) ? 0x90 : 0x80;
+            high = (0xF4 == c) ? 0x8F : 0xBF;
+        }
+        else
+        {
+            return false;
+        }
+
+        if (i + follow >= n || p[i + 1] < low || p[i + 1] > high)
+        {
+            return false;
+        }
+
+        for (int k = 2; k <= follow; k++)
+        {
+            if ((p[i + k] & 0xC0) != 0x80)
+            {
+                return false;
+            }
+        }
+
+        i += follow + 1;
+    }
+
+    return true;
+}
+
+#if defined(QR_X86_SIMD)
+/* Error bits of a lookup-based validator (Keiser, Lemire: Validating UTF-8 In Less Than One Instruction Per Byte)
+ * Each pair of adjacent bytes is checked with three nibble lookups: high and low nibble of the first byte,
+ * high nibble of the second. A bit survives the AND only if all three agree on the error. */
+#define UTF8_TOO_SHORT           (1 << 0)
+#define UTF8_TOO_LONG            (1 << 1)
+#define UTF8_OVERLONG_3          (1 << 2)
+#define UTF8_TOO_LARGE           (1 << 3)
+#define UTF8_SURROGATE           (1 << 4)
+#define UTF8_OVERLONG_2          (1 << 5)
+#define UTF8_TOO_LARGE_1000      (1 << 6)
+#define UTF8_OVERLONG_4          (1 << 6)
+#define UTF8_TWO_CONTS           (1 << 7)
+#define UTF8_CARRY               (UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS)
+
+static const unsigned char UTF8_BYTE_1_HIGH[16] =
+{
+    /* 0xxx: ASCII */
+    UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+    UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+    /* 10xx: continuation */
+    UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS,
+    /* 1100, 1101: 2-byte lead */
+    UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+    UTF8_TOO_SHORT,
+    /* 1110: 3-byte lead */
+    UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+    /* 1111: 4-byte (or longer) lead */
+    UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4
+};
+
+static const unsigned char UTF8_BYTE_1_LOW[16] =
+{
+    UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4,
+    UTF8_CARRY | UTF8_OVERLONG_2,
+    UTF8_CARRY,
+    UTF8_CARRY,
+    UTF8_CARRY | UTF8_TOO_LARGE,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000
+};
+
+static const unsigned char UTF8_BYTE_2_HIGH[16] =
+{
+    /* 0xxx: ASCII */
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+    /* 1000 */
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+    /* 1001 */
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE,
+    /* 101x */
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,
+    /* 11xx: lead */
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT
+};
+
+/* Errors of block v, prev is the block before it */
+QR_TARGET("ssse3")
+static inline __m128i utf8_block_errors(__m128i v, __m128i prev)
+{
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    __m128i prev1 = _mm_alignr_epi8(v, prev, 15);
+    __m128i prev2 = _mm_alignr_epi8(v, prev, 14);
+    __m128i prev3 = _mm_alignr_epi8(v, prev, 13);
+
+    __m128i special = _mm_and_si128(
+        _mm_and_si128(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)UTF8_BYTE_1_HIGH), _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble)),
+                      _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)UTF8_BYTE_1_LOW), _mm_and_si128(prev1, nibble))),
+        _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)UTF8_BYTE_2_HIGH), _mm_and_si128(_mm_srli_epi16(v, 4), nibble)));
+
+    /* Third and fourth bytes of 3- and 4-byte sequences must be continuations, the lookups can not see them */
+    __m128i third = _mm_subs_epu8(prev2, _mm_set1_epi8((char)(0xE0 - 0x80)));
+    __m128i fourth = _mm_subs_epu8(prev3, _mm_set1_epi8((char)(0xF0 - 0x80)));
+    __m128i must_continue = _mm_and_si128(_mm_or_si128(third, fourth), _mm_set1_epi8((char)0x80));
+
+    return _mm_xor_si128(must_continue, special);
+}
+
+QR_TARGET("ssse3")
+static bool utf8_valid_ssse3(const unsigned char *p, int n)
+{
+    /* Non zero if the block ends inside a sequence */
+    const __m128i max_last = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                           (char)(0xF0 - 1), (char)(0xE0 - 1), (char)(0xC0 - 1));
+    __m128i error = _mm_setzero_si128();
+    __m128i prev = _mm_setzero_si128();
+    __m128i incomplete = _mm_setzero_si128();
+    int i = 0;
+
+    for (; i < n; i += 16)
+    {
+        __m128i v;
+
+        if (i + 16 <= n)
+        {
+            v = _mm_loadu_si128((const __m128i *)(p + i));
+        }
+        else
+        {
+            /* Zero padded tail, a sequence cut by the end of content is TOO_SHORT */
+            unsigned char tail[16] = {0};
+            memcpy(tail, p + i, n - i);
+            v = _mm_loadu_si128((const __m128i *)tail);
+        }
+
+        /* ASCII fast path */
+        if (0 == _mm_movemask_epi8(v))
+        {
+            error = _mm_or_si128(error, incomplete);
+            incomplete = _mm_setzero_si128();
+        }
+        else
+        {
+            error = _mm_or_si128(error, utf8_block_errors(v, prev));
+            incomplete = _mm_subs_epu8(v, max_last);
+        }
+
+        prev = v;
+    }
+
+    error = _mm_or_si128(error, incomplete);
+
+    return (0xFFFF == _mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())));
+}
+#endif
+
+/* Valid UTF-8, content has bytes above 0x7F (all ASCII content stays ISO 8859-1) */
+static bool is_UTF8(const string &content)
+{
+    const unsigned char *p = (const unsigned char *)content.data();
+    int n = content.size();
+
+#if defined(QR_X86_SIMD)
+    if (cpu_has_ssse3())
+    {
+        return utf8_valid_ssse3(p, n);
+    }
+#endif
+
+    return utf8_valid_scalar(p, n);
+}
+
+/* Shift JIS double-byte character in the KANJI mode ranges */
+bool is_kanji_pair(unsigned char first, unsigned char second)
+{
+    int v = (first << 8) | second;
+
+    if ((v < 0x8140 || v > 0x9FFC) && (v < 0xE040 || v > 0xEBBF))
+    {
+        return false;
+    }
+
+    return (second >= 0x40 && second <= 0xFC && second != 0x7F);
+}
+
+#if defined(QR_X86_SIMD)
+/* Class bits of byte c: HIGH_NIBBLE[c >> 4] & LOW_NIBBLE[c & 0x0F]
+ * Bit 0: digit; bits 1~4: alphanumeric character with high nibble 2, 3, 4, 5 */
+static const unsigned char LOW_NIBBLE[16] = {0x17, 0x1D, 0x1D, 0x1D, 0x1F, 0x1F, 0x1D, 0x1D, 0x1D, 0x1D, 0x1E, 0x0A, 0x08, 0x0A, 0x0A, 0x0A};
+static const unsigned char HIGH_NIBBLE[16] = {0x00, 0x00, 0x02, 0x05, 0x08, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+
+/* Whole blocks of 16 bytes, returns the number of bytes classified
+ * A block of a single class only records a boundary when that class differs from the current run */
+QR_TARGET("ssse3")
+static int classify_ssse3(const unsigned char *p, int n, int &widest, bool &high, int &run, vector<int> *boundaries)
+{
+    const __m128i low_nibble = _mm_loadu_si128((const __m128i *)LOW_NIBBLE);
+    const __m128i high_nibble = _mm_loadu_si128((const __m128i *)HIGH_NIBBLE);
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    const __m128i digit_bit = _mm_set1_epi8(0x01);
+    const __m128i alpha_bits = _mm_set1_epi8(0x1E);
+    const __m128i zero = _mm_setzero_si128();
+    int non_digit = 0, non_alpha = 0, non_ascii = 0;
+    int i = 0;
+
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        __m128i bits = _mm_and_si128(_mm_shuffle_epi8(high_nibble, _mm_and_si128(_mm_srli_epi16(v, 4), nibble)),
+                                     _mm_shuffle_epi8(low_nibble, _mm_and_si128(v, nibble)));
+
+        int digit = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(bits, digit_bit), digit_bit));
+        int alpha = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(bits, alpha_bits), zero)) ^ 0xFFFF;
+
+        non_digit |= digit ^ 0xFFFF;
+        non_alpha |= alpha ^ 0xFFFF;
+        non_ascii |= _mm_movemask_epi8(v);
+
+        if (!boundaries)
+        {
+            continue;
+        }
+
+        int block = -1;
+
+        if (0xFFFF == digit)
+        {
+            block = NUMERIC;
+        }
+        else if (0xFFFF == alpha && 0 == digit)
+        {
+            block = ALPHA_NUMERIC;
+        }
+        else if (0 == alpha)
+        {
+            block = BYTE;
+        }
+
+        if (block >= 0)
+        {
+            if (block != run)
+            {
+                boundaries->push_back(i);
+                run = block;
+            }
+            continue;
+        }
+
+        for (int k = 0; k < 16; k++)
+        {
+            int c = ((digit >> k) & 0x01) ? NUMERIC : (((alpha >> k) & 0x01) ? ALPHA_NUMERIC : BYTE);
+
+            if (c != run)
+            {
+                boundaries->push_back(i + k);
+                run = c;
+            }
+        }
+    }
+
+    if (i > 0)
+    {
+        widest = non_alpha ? BYTE : (non_digit ? ALPHA_NUMERIC : NUMERIC);
+        high = (non_ascii != 0);
+    }
+
+    return i;
+}
+#endif
+
+CONTENT_CLASS classify_content(const string &content, vector<int> *boundaries)
+{
+    const unsigned char *p = (const unsigned char *)content.data();
+    int n = content.size();
+    int widest = -1, run = -1, i = 0;
+    bool high = false;
+    CONTENT_CLASS info;
+
+    if (boundaries)
+    {
+        boundaries->clear();
+    }
+
+#if defined(QR_X86_SIMD)
+    if (cpu_has_ssse3())
+    {
+        i = classify_ssse3(p, n, widest, high, run, boundaries);
+    }
+#endif
+
+    for (; i < n; i++)
+    {
+        int c = character_class(p[i]);
+
+        widest = (c > widest) ? c : widest;
+        high = high || (p[i] & 0x80);
+
+        if (boundaries && c != run)
+        {
+            boundaries->push_back(i);
+            run = c;
+        }
+    }
+
+    info.mode = widest;
+    info.encoding = ISO_8859_1;
+
+    /* KANJI and UTF-8 both need bytes above 0x7F */
+    if (high)
+    {
+        if (is_kanji(content))
+        {
+            info.mode = KANJI;
+        }
+
+        if (is_UTF8(content))
+        {
+            info.encoding = UTF_8;
+        }
+    }
+
+    return info;
+}
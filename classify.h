@@ -0,0 +1,39 @@
+#ifndef _CLASSIFY_H_
+#define _CLASSIFY_H_
+
+#include "QR.h"
+
+/* ALPHA_NUMERIC_VALUE[c]: value of byte c in ALPHA_NUMERIC mode (0~44), -1 if it is not one of the 45 characters */
+extern const signed char ALPHA_NUMERIC_VALUE[256];
+
+/* Convert character to alphanumeric value */
+static inline int alpha_numeric_value(unsigned char c)
+{
+    return ALPHA_NUMERIC_VALUE[c];
+}
+
+/* Narrowest of NUMERIC / ALPHA_NUMERIC / BYTE that can encode byte c */
+static inline int character_class(unsigned char c)
+{
+    int value = ALPHA_NUMERIC_VALUE[c];
+
+    return (value < 0) ? BYTE : ((value < 10) ? NUMERIC : ALPHA_NUMERIC);
+}
+
+/* Shift JIS double-byte character in the KANJI mode ranges */
+bool is_kanji_pair(unsigned char first, unsigned char second);
+
+typedef struct
+{
+    /* Mode for the whole content: KANJI, else the widest character class; -1 if empty */
+    int mode;
+    /* ISO_8859_1 or UTF_8 */
+    int encoding;
+}CONTENT_CLASS;
+
+/* Mode and encoding of content in one pass
+ * With boundaries, also the offsets where runs of bytes of the same character_class start (the first is 0).
+ * Blocks of 16 bytes are classified with SSSE3 when the CPU supports it. */
+CONTENT_CLASS classify_content(const string &content, vector<int> *boundaries = NULL);
+
+#endif /* _CLASSIFY_H_ */
@@ -0,0 +1,94 @@
+#ifndef _MATRIX_H_
+#define _MATRIX_H_
+
+#include <stdint.h>
+#include <vector>
+using std::vector;
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+/* Number of set bits in a 64-bit word */
+static inline int popcount64(uint64_t value)
+{
+#if defined(__GNUC__)
+    return __builtin_popcountll(value);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    return (int)__popcnt64(value);
+#else
+    value = value - ((value >> 1) & 0x5555555555555555ULL);
+    value = (value & 0x3333333333333333ULL) + ((value >> 2) & 0x3333333333333333ULL);
+    value = (value + (value >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return (int)((value*0x0101010101010101ULL) >> 56);
+#endif
+}
+
+/* Square bit matrix, size*size bits
+ * Each row is padded to whole 64-bit words, the padding bits are always 0.
+ * Column y is bit (63 - y%64) of word y/64: the words read MSB first, in the same order as png 1-bit rows. */
+class BIT_MATRIX
+{
+public:
+    int size;
+    /* 64-bit words per row */
+    int words;
+    vector<uint64_t> bits;
+
+    BIT_MATRIX(int size = 0)
+    {
+        resize(size);
+    }
+
+    /* Resize and clear all bits */
+    void resize(int new_size)
+    {
+        size = new_size;
+        words = (new_size + 63)/64;
+        bits.assign(size*words, 0);
+    }
+
+    bool get(int x, int y) const
+    {
+        return (bits[x*words + (y >> 6)] >> (63 - (y & 0x3F))) & 0x01;
+    }
+
+    void set(int x, int y, bool value)
+    {
+        uint64_t bit = 1ULL << (63 - (y & 0x3F));
+
+        if (value)
+        {
+            bits[x*words + (y >> 6)] |= bit;
+        }
+        else
+        {
+            bits[x*words + (y >> 6)] &= ~bit;
+        }
+    }
+
+    uint64_t *row(int x)
+    {
+        return &bits[x*words];
+    }
+
+    const uint64_t *row(int x) const
+    {
+        return &bits[x*words];
+    }
+
+    /* Number of set bits */
+    int count() const
+    {
+        int n = 0;
+
+        for (unsigned int i = 0; i < bits.size(); i++)
+        {
+            n += popcount64(bits[i]);
+        }
+
+        return n;
+    }
+};
+
+#endif /* _MATRIX_H_ */
@@ -0,0 +1,202 @@
+#include "penalty.h"
+#include <stdlib.h>
+
+/* Max 64-bit words per row: version 40 is 177 modules wide */
+#define MAX_ROW_WORDS            (3)
+
+/* Penalty weights */
+#define PENALTY_N1               (3)
+#define PENALTY_N2               (3)
+#define PENALTY_N3               (40)
+#define PENALTY_N4               (10)
+
+
+/* Bits of a row shifted by k columns towards column 0 (k < 64): column j gets column j + k */
+static inline uint64_t next(const uint64_t *row, int w, int words, int k)
+{
+    uint64_t value = row[w] << k;
+
+    if (k && w + 1 < words)
+    {
+        value |= row[w + 1] >> (64 - k);
+    }
+
+    return value;
+}
+
+/* Bits of a row shifted by k columns away from column 0 (k < 64): column j gets column j - k */
+static inline uint64_t prev(const uint64_t *row, int w, int k)
+{
+    uint64_t value = row[w] >> k;
+
+    if (k && w > 0)
+    {
+        value |= row[w - 1] << (64 - k);
+    }
+
+    return value;
+}
+
+/* Bits of columns [0, end) of word w */
+static inline uint64_t columns(int w, int end)
+{
+    int n = end - w*64;
+
+    if (n >= 64)
+    {
+        return ~0ULL;
+    }
+
+    return (n <= 0) ? 0 : ~(~0ULL >> n);
+}
+
+/* Rules on a single row (N1 and N3), columns out of the symbol count as light
+ *
+ * N1: a run of n >= 5 same color modules scores 3 + (n - 5).
+ * Bit j of same5 is set if columns j ~ j+4 have the same color, a run of n modules sets n - 4 of them,
+ * and bit j of start is set on the first window of each run, so the run scores count(same5) + 2*count(start).
+ *
+ * N3: 1:1:3:1:1 (dark:light:dark:light:dark) pattern, with 4 light modules before or after it.
+ * Bit j of core is set if columns j ~ j+6 read 1011101, all columns are matched at once. */
+static int row_score(const uint64_t *row, int words, int size)
+{
+    uint64_t same[MAX_ROW_WORDS], same5[MAX_ROW_WORDS];
+    int score = 0;
+
+    for (int w = 0; w < words; w++)
+    {
+        /* Column j has the same color as column j + 1 */
+        same[w] = ~(row[w] ^ next(row, w, words, 1));
+    }
+
+    for (int w = 0; w < words; w++)
+    {
+        same5[w] = same[w] & next(same, w, words, 1) & next(same, w, words, 2) & next(same, w, words, 3);
+        same5[w] &= columns(w, size - 4);
+    }
+
+    for (int w = 0; w < words; w++)
+    {
+        uint64_t start = same5[w] & ~prev(same5, w, 1);
+
+        score += popcount64(same5[w]) + 2*popcount64(start);
+
+        uint64_t core = row[w] & ~next(row, w, words, 1) & next(row, w, words, 2) & next(row, w, words, 3)
+                        & next(row, w, words, 4) & ~next(row, w, words, 5) & next(row, w, words, 6);
+        core &= columns(w, size - 6);
+
+        if (core)
+        {
+            /* Columns j-4 ~ j-1 or j+7 ~ j+10 are light (padding bits are light) */
+            uint64_t before = ~(prev(row, w, 1) | prev(row, w, 2) | prev(row, w, 3) | prev(row, w, 4));
+            uint64_t after = ~(next(row, w, words, 7) | next(row, w, words, 8) | next(row, w, words, 9) | next(row, w, words, 10));
+
+            score += PENALTY_N3*popcount64(core & (before | after));
+        }
+    }
+
+    return score;
+}
+
+/* N2: each 2*2 block of same color modules scores 3 */
+static int block_score(const uint64_t *row1, const uint64_t *row2, int words, int size)
+{
+    int count = 0;
+
+    for (int w = 0; w < words; w++)
+    {
+        uint64_t same = ~(row1[w] ^ row2[w]) & ~(row1[w] ^ next(row1, w, words, 1)) & ~(row2[w] ^ next(row2, w, words, 1));
+        count += popcount64(same & columns(w, size - 1));
+    }
+
+    return PENALTY_N2*count;
+}
+
+/* Transpose 64*64 bits (row r, column c is bit 63-c of a[r]) */
+static void transpose64(uint64_t a[64])
+{
+    uint64_t m = 0x00000000FFFFFFFFULL;
+
+    for (int j = 32; j != 0; j >>= 1, m ^= (m << j))
+    {
+        for (int k = 0; k < 64; k = ((k | j) + 1) & ~j)
+        {
+            uint64_t t = (a[k] ^ (a[k | j] >> j)) & m;
+            a[k] ^= t;
+            a[k | j] ^= (t << j);
+        }
+    }
+}
+
+void transpose(const BIT_MATRIX &in, BIT_MATRIX &out)
+{
+    uint64_t block[64];
+
+    out.resize(in.size);
+
+    for (int bx = 0; bx < in.words; bx++)
+    {
+        for (int by = 0; by < in.words; by++)
+        {
+            for (int k = 0; k < 64; k++)
+            {
+                int x = bx*64 + k;
+                block[k] = (x < in.size) ? in.row(x)[by] : 0;
+            }
+
+            transpose64(block);
+
+            for (int k = 0; k < 64; k++)
+            {
+                int x = by*64 + k;
+
+                if (x < out.size)
+                {
+                    out.row(x)[bx] = block[k];
+                }
+            }
+        }
+    }
+}
+
+static inline bool exceeds(int score, const std::atomic<int> *limit)
+{
+    return (NULL != limit) && (score > limit->load(std::memory_order_relaxed));
+}
+
+int penalty_score(const BIT_MATRIX &matrix, const std::atomic<int> *limit)
+{
+    int size = matrix.size;
+    BIT_MATRIX columns;
+
+    /* N4: 10 points for every 5% of deviation of the dark modules proportion from 50% */
+    int ratio = abs(50 - (matrix.count()*100)/(size*size))/5;
+    int score = PENALTY_N4*ratio;
+
+    /* N2 */
+    for (int i = 0; i < size - 1; i++)
+    {
+        score += block_score(matrix.row(i), matrix.row(i + 1), matrix.words, size);
+    }
+
+    if (exceeds(score, limit))
+    {
+        return score;
+    }
+
+    /* Rows, then columns as rows of the transposed matrix */
+    transpose(matrix, columns);
+
+    for (int i = 0; i < size; i++)
+    {
+        score += row_score(matrix.row(i), matrix.words, size);
+        score += row_score(columns.row(i), columns.words, size);
+
+        if (exceeds(score, limit))
+        {
+            return score;
+        }
+    }
+
+    return score;
+}
@@ -0,0 +1,15 @@
+#ifndef _PENALTY_H_
+#define _PENALTY_H_
+
+#include "matrix.h"
+#include <stddef.h>
+#include <atomic>
+
+/* Penalty points score of a masked symbol: N1 + N2 + N3 + N4
+ * With a limit, scoring stops as soon as the partial score exceeds it, and the partial score is returned. */
+int penalty_score(const BIT_MATRIX &matrix, const std::atomic<int> *limit = NULL);
+
+/* Transpose of a bit matrix: row x of out is column x of in */
+void transpose(const BIT_MATRIX &in, BIT_MATRIX &out);
+
+#endif /* _PENALTY_H_ */
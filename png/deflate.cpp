@@ -0,0 +1,739 @@
+#include "deflate.h"
+#include <algorithm>
+#include <cstring>
+#include <queue>
+using namespace std;
+
+/* LZ77 window: distances up to 32K */
+#define WINDOW_SIZE     32768
+#define WINDOW_MASK     (WINDOW_SIZE - 1)
+#define MIN_MATCH       3
+#define MAX_MATCH       258
+
+/* Pending input compressed as one block */
+#define BLOCK_INPUT     65536
+/* Max bytes of a stored block */
+#define STORED_MAX      65535
+
+#define HASH_SIZE       32768
+
+/* Literal/length alphabet: 0~255 literals, 256 end of block, 257~285 lengths */
+#define LITERALS        286
+#define END_OF_BLOCK    256
+#define DISTANCES       30
+#define CODE_LENGTHS    19
+
+#define MAX_CODE_BITS   15
+#define MAX_CL_BITS     7
+
+static const unsigned short LENGTH_BASE[29] =
+{
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+
+static const unsigned char LENGTH_EXTRA[29] =
+{
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+
+static const unsigned short DIST_BASE[DISTANCES] =
+{
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+
+static const unsigned char DIST_EXTRA[DISTANCES] =
+{
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+/* Order of the code length code lengths in a dynamic block header */
+static const unsigned char CODE_LENGTH_ORDER[CODE_LENGTHS] =
+{
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+/* Hash chain length by level, 0: runs and repeated rows only */
+static const int CHAIN_LENGTH[10] = {0, 0, 0, 0, 8, 16, 32, 64, 128, 256};
+
+/* Literal (dist = 0, value = byte) or match (length, dist) */
+typedef struct
+{
+    unsigned short value;
+    unsigned short dist;
+}TOKEN;
+
+/* Huffman code: bit reversed for LSB first output */
+typedef struct
+{
+    unsigned short code;
+    unsigned char len;
+}CODE;
+
+/* Symbol lookups derived from the base tables */
+class DEFLATE_TABLES
+{
+public:
+    /* Length symbol index (0~28) of match length 3~258 */
+    unsigned char length_code[MAX_MATCH + 1];
+    /* Distance symbol of distance 1~256, and of (distance - 1) >> 7 beyond */
+    unsigned char dist_low[256];
+    unsigned char dist_high[256];
+    /* Fixed Huffman codes */
+    CODE fixed_lit[288];
+    CODE fixed_dist[32];
+
+    DEFLATE_TABLES();
+
+    int dist_code(int dist) const
+    {
+        return (dist <= 256) ? dist_low[dist - 1] : dist_high[(dist - 1) >> 7];
+    }
+};
+
+static void build_codes(const unsigned char *lengths, int count, CODE *codes);
+
+DEFLATE_TABLES::DEFLATE_TABLES()
+{
+    for (int i = 0; i < 29; i++)
+    {
+        int end = (i + 1 < 29) ? LENGTH_BASE[i + 1] : MAX_MATCH + 1;
+
+        for (int len = LENGTH_BASE[i]; len < end && len <= MAX_MATCH; len++)
+        {
+            length_code[len] = i;
+        }
+    }
+    /* 258 has its own code, not 227 + 31 */
+    length_code[MAX_MATCH] = 28;
+
+    for (int i = 0; i < DISTANCES; i++)
+    {
+        int end = (i + 1 < DISTANCES) ? DIST_BASE[i + 1] : WINDOW_SIZE + 1;
+
+        for (int dist = DIST_BASE[i]; dist < end; dist++)
+        {
+            if (dist <= 256)
+            {
+                dist_low[dist - 1] = i;
+            }
+            else
+            {
+                dist_high[(dist - 1) >> 7] = i;
+            }
+        }
+    }
+
+    unsigned char lengths[288];
+
+    for (int i = 0; i < 288; i++)
+    {
+        lengths[i] = (i < 144) ? 8 : ((i < 256) ? 9 : ((i < 280) ? 7 : 8));
+    }
+    build_codes(lengths, 288, fixed_lit);
+
+    for (int i = 0; i < 32; i++)
+    {
+        lengths[i] = 5;
+    }
+    build_codes(lengths, 32, fixed_dist);
+}
+
+static const DEFLATE_TABLES &deflate_tables()
+{
+    static const DEFLATE_TABLES tables;
+    return tables;
+}
+
+/* Canonical Huffman codes from code lengths (RFC 1951 3.2.2) */
+static void build_codes(const unsigned char *lengths, int count, CODE *codes)
+{
+    int bl_count[MAX_CODE_BITS + 1] = {0};
+    int next_code[MAX_CODE_BITS + 1] = {0};
+
+    for (int i = 0; i < count; i++)
+    {
+        bl_count[lengths[i]]++;
+    }
+    bl_count[0] = 0;
+
+    for (int bits = 1, code = 0; bits <= MAX_CODE_BITS; bits++)
+    {
+        code = (code + bl_count[bits - 1]) << 1;
+        next_code[bits] = code;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        int len = lengths[i];
+        int code = len ? next_code[len]++ : 0;
+        int reversed = 0;
+
+        for (int b = 0; b < len; b++)
+        {
+            reversed = (reversed << 1) | ((code >> b) & 0x01);
+        }
+
+        codes[i].code = reversed;
+        codes[i].len = len;
+    }
+}
+
+/* Huffman code lengths of count symbols, at most max_len bits
+ * Depths come from a plain Huffman tree; when it is too deep, the length counts are rebalanced
+ * (Kraft sum kept at 1) and lengths handed out again, shortest to the most frequent symbols.
+ * At least two symbols get a code, so every tree is complete. */
+static void build_lengths(const unsigned int *freq, int count, int max_len, unsigned char *lengths)
+{
+    vector<int> symbols;
+
+    memset(lengths, 0, count);
+    for (int i = 0; i < count; i++)
+    {
+        if (freq[i])
+        {
+            symbols.push_back(i);
+        }
+    }
+
+    for (int i = 0; symbols.size() < 2; i++)
+    {
+        if (!freq[i])
+        {
+            symbols.push_back(i);
+        }
+    }
+
+    int n = symbols.size();
+
+    /* Nodes 0~n-1 are leaves, internal nodes follow in creation order */
+    vector<unsigned long long> weight(2*n - 1);
+    vector<int> parent(2*n - 1, -1);
+    priority_queue<pair<unsigned long long, int>, vector<pair<unsigned long long, int> >, greater<pair<unsigned long long, int> > > queue;
+
+    for (int i = 0; i < n; i++)
+    {
+        weight[i] = freq[symbols[i]] ? freq[symbols[i]] : 1;
+        queue.push(make_pair(weight[i], i));
+    }
+
+    for (int next = n; next < 2*n - 1; next++)
+    {
+        pair<unsigned long long, int> a = queue.top();
+        queue.pop();
+        pair<unsigned long long, int> b = queue.top();
+        queue.pop();
+
+        weight[next] = a.first + b.first;
+        parent[a.second] = parent[b.second] = next;
+        queue.push(make_pair(weight[next], next));
+    }
+
+    /* Parents always come after their children */
+    vector<int> depth(2*n - 1, 0);
+    int bl_count[64] = {0};
+
+    for (int i = 2*n - 3; i >= 0; i--)
+    {
+        depth[i] = depth[parent[i]] + 1;
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        bl_count[(depth[i] < 63) ? depth[i] : 63]++;
+    }
+
+    for (int i = max_len + 1; i < 64; i++)
+    {
+        bl_count[max_len] += bl_count[i];
+        bl_count[i] = 0;
+    }
+
+    unsigned long long total = 0;
+    for (int i = 1; i <= max_len; i++)
+    {
+        total += (unsigned long long)bl_count[i] << (max_len - i);
+    }
+
+    /* Over-subscribed: move one leaf down from max_len, split a shorter leaf to make room */
+    while (total > (1ULL << max_len))
+    {
+        bl_count[max_len]--;
+        for (int i = max_len - 1; i > 0; i--)
+        {
+            if (bl_count[i])
+            {
+                bl_count[i]--;
+                bl_count[i + 1] += 2;
+                break;
+            }
+        }
+        total--;
+    }
+
+    /* Most frequent first */
+    stable_sort(symbols.begin(), symbols.end(), [&](int a, int b)
+    {
+        return freq[a] > freq[b];
+    });
+
+    for (int len = 1, i = 0; len <= max_len; len++)
+    {
+        for (int k = 0; k < bl_count[len]; k++)
+        {
+            lengths[symbols[i++]] = len;
+        }
+    }
+}
+
+/* Code length symbols (0~18, with repeat counts in extra) of the concatenated literal and distance code lengths */
+static void run_length(const unsigned char *lengths, int count, vector<unsigned char> &symbols, vector<unsigned char> &extra)
+{
+    for (int i = 0; i < count; )
+    {
+        int len = lengths[i];
+        int run = 1;
+
+        while (i + run < count && lengths[i + run] == len)
+        {
+            run++;
+        }
+
+        if (0 == len && run >= 3)
+        {
+            int n = (run > 138) ? 138 : run;
+
+            symbols.push_back((n >= 11) ? 18 : 17);
+            extra.push_back((n >= 11) ? n - 11 : n - 3);
+            i += n;
+        }
+        else if (len && run >= 4)
+        {
+            int n = (run - 1 > 6) ? 6 : run - 1;
+
+            symbols.push_back(len);
+            extra.push_back(0);
+            symbols.push_back(16);
+            extra.push_back(n - 3);
+            i += n + 1;
+        }
+        else
+        {
+            symbols.push_back(len);
+            extra.push_back(0);
+            i++;
+        }
+    }
+}
+
+/* Length of the common prefix of a and b, at most limit */
+static inline int match_length(const unsigned char *a, const unsigned char *b, int limit)
+{
+    int len = 0;
+
+    while (len + 8 <= limit)
+    {
+        unsigned long long x, y;
+        memcpy(&x, a + len, 8);
+        memcpy(&y, b + len, 8);
+
+        if (x != y)
+        {
+            /* First differing byte (little endian load) */
+            unsigned long long diff = x ^ y;
+            while (!(diff & 0xFF))
+            {
+                diff >>= 8;
+                len++;
+            }
+            return len;
+        }
+        len += 8;
+    }
+
+    while (len < limit && a[len] == b[len])
+    {
+        len++;
+    }
+
+    return len;
+}
+
+static inline int hash3(const unsigned char *p)
+{
+    return ((p[0] << 10) ^ (p[1] << 5) ^ p[2]) & (HASH_SIZE - 1);
+}
+
+DEFLATE::DEFLATE(int level, int stride)
+{
+    this->level = (level < DEFLATE_STORED) ? DEFLATE_STORED : ((level > DEFLATE_BEST) ? DEFLATE_BEST : level);
+    this->stride = (stride > 0 && stride <= WINDOW_SIZE) ? stride : 0;
+    history = 0;
+    base = 0;
+    bits = 0;
+    bit_count = 0;
+    finished = false;
+
+    if (CHAIN_LENGTH[this->level])
+    {
+        head.assign(HASH_SIZE, 0);
+        prev.assign(WINDOW_SIZE, 0);
+    }
+}
+
+void DEFLATE::put_bits(vector<unsigned char> &out, unsigned int value, int len)
+{
+    bits |= (unsigned long long)value << bit_count;
+    bit_count += len;
+
+    while (bit_count >= 8)
+    {
+        out.push_back((unsigned char)bits);
+        bits >>= 8;
+        bit_count -= 8;
+    }
+}
+
+void DEFLATE::align(vector<unsigned char> &out)
+{
+    if (bit_count)
+    {
+        put_bits(out, 0, 8 - bit_count);
+    }
+}
+
+/* Non-compressed blocks (BTYPE=00) of at most 65535 bytes */
+void DEFLATE::stored_block(vector<unsigned char> &out, const unsigned char *data, size_t len, bool final)
+{
+    size_t done = 0;
+
+    do
+    {
+        size_t n = (len - done > STORED_MAX) ? STORED_MAX : len - done;
+        bool last = final && (done + n == len);
+
+        put_bits(out, last ? 1 : 0, 3);
+        align(out);
+
+        put_bits(out, (unsigned int)n, 16);
+        put_bits(out, (unsigned int)n ^ 0xFFFF, 16);
+        out.insert(out.end(), data + done, data + done + n);
+
+        done += n;
+    } while (done < len);
+}
+
+/* Compress window[history ~ end] as one block (or stored blocks), then slide the window */
+void DEFLATE::compress_block(vector<unsigned char> &out, bool final)
+{
+    const DEFLATE_TABLES &tables = deflate_tables();
+    const unsigned char *data = window.empty() ? NULL : &window[0];
+    size_t end = window.size();
+    size_t pending = end - history;
+
+    if (DEFLATE_STORED == level)
+    {
+        stored_block(out, data ? data + history : NULL, pending, final);
+    }
+    else
+    {
+        vector<TOKEN> tokens;
+        unsigned int lit_freq[LITERALS] = {0};
+        unsigned int dist_freq[DISTANCES] = {0};
+        int chain = CHAIN_LENGTH[level];
+
+        tokens.reserve(pending);
+
+        for (size_t i = history; i < end; )
+        {
+            int limit = (end - i > MAX_MATCH) ? MAX_MATCH : (int)(end - i);
+            int best_len = 0, best_dist = 0;
+
+            if (limit >= MIN_MATCH)
+            {
+                /* Runs and repeated rows */
+                if (i >= 1)
+                {
+                    best_len = match_length(data + i, data + i - 1, limit);
+                    best_dist = 1;
+                }
+
+                if (stride && i >= (size_t)stride && best_len < limit)
+                {
+                    int len = match_length(data + i, data + i - stride, limit);
+
+                    if (len > best_len)
+                    {
+                        best_len = len;
+                        best_dist = stride;
+                    }
+                }
+
+                if (chain)
+                {
+                    size_t pos = base + i;
+                    size_t candidate = head[hash3(data + i)];
+
+                    for (int n = chain; candidate && n && best_len < limit; n--)
+                    {
+                        size_t from = candidate - 1;
+
+                        if (from >= pos || pos - from > WINDOW_SIZE || from < base)
+                        {
+                            break;
+                        }
+
+                        int len = match_length(data + i, data + (from - base), limit);
+
+                        if (len > best_len)
+                        {
+                            best_len = len;
+                            best_dist = (int)(pos - from);
+                        }
+
+                        size_t next = prev[from & WINDOW_MASK];
+                        if (next >= candidate)
+                        {
+                            break;
+                        }
+                        candidate = next;
+                    }
+                }
+            }
+
+            int advance = 1;
+            TOKEN token;
+
+            if (best_len >= MIN_MATCH)
+            {
+                token.value = best_len;
+                token.dist = best_dist;
+                lit_freq[257 + tables.length_code[best_len]]++;
+                dist_freq[tables.dist_code(best_dist)]++;
+                advance = best_len;
+            }
+            else
+            {
+                token.value = data[i];
+                token.dist = 0;
+                lit_freq[data[i]]++;
+            }
+            tokens.push_back(token);
+
+            if (chain)
+            {
+                for (size_t k = i; k < i + advance && k + MIN_MATCH <= end; k++)
+                {
+                    int h = hash3(data + k);
+
+                    prev[(base + k) & WINDOW_MASK] = head[h];
+                    head[h] = base + k + 1;
+                }
+            }
+
+            i += advance;
+        }
+
+        lit_freq[END_OF_BLOCK]++;
+
+        /* Bits of the block body for each choice of codes */
+        unsigned long long extra_bits = 0;
+        for (int i = 0; i < 29; i++)
+        {
+            extra_bits += (unsigned long long)lit_freq[257 + i]*LENGTH_EXTRA[i];
+        }
+        for (int i = 0; i < DISTANCES; i++)
+        {
+            extra_bits += (unsigned long long)dist_freq[i]*DIST_EXTRA[i];
+        }
+
+        unsigned long long fixed_cost = 3 + extra_bits;
+        for (int i = 0; i < LITERALS; i++)
+        {
+            fixed_cost += (unsigned long long)lit_freq[i]*tables.fixed_lit[i].len;
+        }
+        for (int i = 0; i < DISTANCES; i++)
+        {
+            fixed_cost += (unsigned long long)dist_freq[i]*5;
+        }
+
+        unsigned char lengths[LITERALS + DISTANCES];
+        unsigned char cl_lengths[CODE_LENGTHS];
+        vector<unsigned char> cl_symbols, cl_extra;
+        int hlit = 257, hdist = 1, hclen = 4;
+        unsigned long long dynamic_cost = ~0ULL;
+
+        if (level > DEFLATE_FASTEST)
+        {
+            build_lengths(lit_freq, LITERALS, MAX_CODE_BITS, lengths);
+            build_lengths(dist_freq, DISTANCES, MAX_CODE_BITS, lengths + LITERALS);
+
+            hlit = LITERALS;
+            while (hlit > 257 && !lengths[hlit - 1])
+            {
+                hlit--;
+            }
+
+            hdist = DISTANCES;
+            while (hdist > 1 && !lengths[LITERALS + hdist - 1])
+            {
+                hdist--;
+            }
+
+            /* Literal and distance code lengths are run length coded as one sequence */
+            unsigned char sequence[LITERALS + DISTANCES];
+            memcpy(sequence, lengths, hlit);
+            memcpy(sequence + hlit, lengths + LITERALS, hdist);
+            run_length(sequence, hlit + hdist, cl_symbols, cl_extra);
+
+            unsigned int cl_freq[CODE_LENGTHS] = {0};
+            for (size_t i = 0; i < cl_symbols.size(); i++)
+            {
+                cl_freq[cl_symbols[i]]++;
+            }
+            build_lengths(cl_freq, CODE_LENGTHS, MAX_CL_BITS, cl_lengths);
+
+            hclen = CODE_LENGTHS;
+            while (hclen > 4 && !cl_lengths[CODE_LENGTH_ORDER[hclen - 1]])
+            {
+                hclen--;
+            }
+
+            dynamic_cost = 3 + 5 + 5 + 4 + 3*hclen + extra_bits;
+            for (size_t i = 0; i < cl_symbols.size(); i++)
+            {
+                int s = cl_symbols[i];
+                dynamic_cost += cl_lengths[s] + ((16 == s) ? 2 : ((17 == s) ? 3 : ((18 == s) ? 7 : 0)));
+            }
+            for (int i = 0; i < LITERALS; i++)
+            {
+                dynamic_cost += (unsigned long long)lit_freq[i]*lengths[i];
+            }
+            for (int i = 0; i < DISTANCES; i++)
+            {
+                dynamic_cost += (unsigned long long)dist_freq[i]*lengths[LITERALS + i];
+            }
+        }
+
+        /* Header, alignment and LEN/NLEN of each stored block */
+        unsigned long long stored_cost = (unsigned long long)pending*8 + ((pending + STORED_MAX - 1)/STORED_MAX + (pending == 0))*(3 + 7 + 32);
+
+        if (stored_cost < fixed_cost && stored_cost < dynamic_cost)
+        {
+            stored_block(out, data ? data + history : NULL, pending, final);
+        }
+        else
+        {
+            CODE lit_codes[LITERALS], dist_codes[DISTANCES];
+            const CODE *lit = tables.fixed_lit, *dist = tables.fixed_dist;
+
+            if (dynamic_cost < fixed_cost)
+            {
+                CODE cl_codes[CODE_LENGTHS];
+
+                build_codes(lengths, LITERALS, lit_codes);
+                build_codes(lengths + LITERALS, DISTANCES, dist_codes);
+                build_codes(cl_lengths, CODE_LENGTHS, cl_codes);
+                lit = lit_codes;
+                dist = dist_codes;
+
+                /* BFINAL, BTYPE = 10 */
+                put_bits(out, (final ? 1 : 0) | (2 << 1), 3);
+                put_bits(out, hlit - 257, 5);
+                put_bits(out, hdist - 1, 5);
+                put_bits(out, hclen - 4, 4);
+
+                for (int i = 0; i < hclen; i++)
+                {
+                    put_bits(out, cl_lengths[CODE_LENGTH_ORDER[i]], 3);
+                }
+
+                for (size_t i = 0; i < cl_symbols.size(); i++)
+                {
+                    int s = cl_symbols[i];
+
+                    put_bits(out, cl_codes[s].code, cl_codes[s].len);
+                    if (s >= 16)
+                    {
+                        put_bits(out, cl_extra[i], (16 == s) ? 2 : ((17 == s) ? 3 : 7));
+                    }
+                }
+            }
+            else
+            {
+                /* BFINAL, BTYPE = 01 */
+                put_bits(out, (final ? 1 : 0) | (1 << 1), 3);
+            }
+
+            for (size_t i = 0; i < tokens.size(); i++)
+            {
+                const TOKEN &token = tokens[i];
+
+                if (0 == token.dist)
+                {
+                    put_bits(out, lit[token.value].code, lit[token.value].len);
+                }
+                else
+                {
+                    int l = tables.length_code[token.value];
+                    int d = tables.dist_code(token.dist);
+
+                    put_bits(out, lit[257 + l].code, lit[257 + l].len);
+                    put_bits(out, token.value - LENGTH_BASE[l], LENGTH_EXTRA[l]);
+                    put_bits(out, dist[d].code, dist[d].len);
+                    put_bits(out, token.dist - DIST_BASE[d], DIST_EXTRA[d]);
+                }
+            }
+
+            put_bits(out, lit[END_OF_BLOCK].code, lit[END_OF_BLOCK].len);
+        }
+    }
+
+    /* Keep the last 32K bytes as match history */
+    if (window.size() > WINDOW_SIZE)
+    {
+        size_t drop = window.size() - WINDOW_SIZE;
+
+        window.erase(window.begin(), window.begin() + drop);
+        base += drop;
+    }
+    history = window.size();
+}
+
+size_t DEFLATE::bound(size_t len)
+{
+    /* No block costs more than storing it: each BLOCK_INPUT block (and the final one) is at most
+     * two stored blocks of 42 header, alignment and LEN/NLEN bits, plus the last partial byte */
+    return len + 11*(len/BLOCK_INPUT + 1) + 1;
+}
+
+void DEFLATE::write(const unsigned char *data, size_t len, vector<unsigned char> &out)
+{
+    while (len && !finished)
+    {
+        size_t n = BLOCK_INPUT - (window.size() - history);
+
+        n = (n > len) ? len : n;
+        window.insert(window.end(), data, data + n);
+        data += n;
+        len -= n;
+
+        if (window.size() - history >= BLOCK_INPUT)
+        {
+            compress_block(out, false);
+        }
+    }
+}
+
+void DEFLATE::finish(vector<unsigned char> &out)
+{
+    if (!finished)
+    {
+        compress_block(out, true);
+        align(out);
+        finished = true;
+    }
+}
@@ -0,0 +1,63 @@
+/* Reference (DEFLATE Compressed Data Format Specification):
+ * https://www.ietf.org/rfc/rfc1951.txt
+ */
+
+#ifndef _DEFLATE_H_
+#define _DEFLATE_H_
+
+#include <stddef.h>
+#include <vector>
+using std::vector;
+
+/* Compression levels
+ * 0: stored blocks (no compression)
+ * 1: fixed Huffman codes (or stored blocks if smaller), runs and repeated rows only
+ * 2~3: best of stored / fixed / dynamic Huffman blocks, runs and repeated rows only
+ * 4~9: as 2~3, plus a hash chain search that gets longer with the level */
+#define DEFLATE_STORED           (0)
+#define DEFLATE_FASTEST          (1)
+#define DEFLATE_DEFAULT          (6)
+#define DEFLATE_BEST             (9)
+
+/* Raw DEFLATE stream (no zlib header or trailer)
+ * Input may be written in pieces, compressed bytes are appended to out as blocks complete.
+ * Matches are looked for at distance 1 (runs) and at distance stride (the same bytes one row up),
+ * which covers most of a filtered 1-bpp raster; higher levels also search a hash chain. */
+class DEFLATE
+{
+private:
+    int level;
+    int stride;
+    /* Last 32K bytes of compressed input (match history) followed by pending input */
+    vector<unsigned char> window;
+    /* Bytes of window already compressed */
+    size_t history;
+    /* Stream offset of window[0] */
+    size_t base;
+    /* Hash chains: head[hash] and prev[position & 0x7FFF] are stream offsets + 1, 0 for none */
+    vector<size_t> head;
+    vector<size_t> prev;
+    /* Pending output bits, LSB first */
+    unsigned long long bits;
+    int bit_count;
+    bool finished;
+
+    void put_bits(vector<unsigned char> &out, unsigned int value, int len);
+    void align(vector<unsigned char> &out);
+    void compress_block(vector<unsigned char> &out, bool final);
+    void stored_block(vector<unsigned char> &out, const unsigned char *data, size_t len, bool final);
+
+public:
+    DEFLATE(int level = DEFLATE_DEFAULT, int stride = 0);
+
+    /* Max compressed bytes of len input bytes, however they are written */
+    static size_t bound(size_t len);
+
+    /* Compress len bytes of data */
+    void write(const unsigned char *data, size_t len, vector<unsigned char> &out);
+
+    /* Compress the pending input as the final block and flush the last bits */
+    void finish(vector<unsigned char> &out);
+};
+
+#endif /* _DEFLATE_H_ */
@@ -0,0 +1,162 @@
+#include "filter.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+/* SSE2 is part of x86-64, so it needs no runtime check */
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PNG_SSE2 1
+#include <emmintrin.h>
+#endif
+
+/* Predictor of Paeth: whichever of a (left), b (above), c (upper left) is closest to a + b - c */
+static inline int paeth(int a, int b, int c)
+{
+    int pa = abs(b - c);
+    int pb = abs(a - c);
+    int pc = abs(a + b - 2*c);
+
+    return (pa <= pb && pa <= pc) ? a : ((pb <= pc) ? b : c);
+}
+
+/* Filtered byte x: bytes left of the scanline count as 0 */
+static inline unsigned char filter_byte(int type, const unsigned char *raw, const unsigned char *prior, size_t x, int bpp)
+{
+    int a = (x >= (size_t)bpp) ? raw[x - bpp] : 0;
+    int b = prior[x];
+    int c = (x >= (size_t)bpp) ? prior[x - bpp] : 0;
+    int predictor = 0;
+
+    switch (type)
+    {
+        case 1:
+            predictor = a;
+            break;
+
+        case 2:
+            predictor = b;
+            break;
+
+        case 3:
+            predictor = (a + b) >> 1;
+            break;
+
+        case 4:
+            predictor = paeth(a, b, c);
+            break;
+    }
+
+    return (unsigned char)(raw[x] - predictor);
+}
+
+#if defined(PNG_SSE2)
+
+static inline __m128i abs_epi16(__m128i v)
+{
+    return _mm_max_epi16(v, _mm_sub_epi16(_mm_setzero_si128(), v));
+}
+
+/* Paeth predictor of 8 pixels bytes widened to 16 bits */
+static inline __m128i paeth_epi16(__m128i a, __m128i b, __m128i c)
+{
+    __m128i pa = abs_epi16(_mm_sub_epi16(b, c));
+    __m128i pb = abs_epi16(_mm_sub_epi16(a, c));
+    __m128i pc = abs_epi16(_mm_add_epi16(_mm_sub_epi16(a, c), _mm_sub_epi16(b, c)));
+
+    /* not_a: pa > pb or pa > pc, use_c: pb > pc */
+    __m128i not_a = _mm_or_si128(_mm_cmpgt_epi16(pa, pb), _mm_cmpgt_epi16(pa, pc));
+    __m128i use_c = _mm_cmpgt_epi16(pb, pc);
+    __m128i bc = _mm_or_si128(_mm_and_si128(use_c, c), _mm_andnot_si128(use_c, b));
+
+    return _mm_or_si128(_mm_and_si128(not_a, bc), _mm_andnot_si128(not_a, a));
+}
+
+/* Bytes [x, x + 16) with x >= bpp */
+static inline __m128i filter_16(int type, const unsigned char *raw, const unsigned char *prior, size_t x, int bpp)
+{
+    __m128i r = _mm_loadu_si128((const __m128i *)(raw + x));
+    __m128i a = _mm_loadu_si128((const __m128i *)(raw + x - bpp));
+    __m128i b = _mm_loadu_si128((const __m128i *)(prior + x));
+
+    switch (type)
+    {
+        case 1:
+            return _mm_sub_epi8(r, a);
+
+        case 2:
+            return _mm_sub_epi8(r, b);
+
+        case 3:
+        {
+            /* floor((a + b)/2): PAVGB rounds up */
+            __m128i average = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1)));
+            return _mm_sub_epi8(r, average);
+        }
+
+        case 4:
+        {
+            __m128i c = _mm_loadu_si128((const __m128i *)(prior + x - bpp));
+            __m128i zero = _mm_setzero_si128();
+            __m128i lo = paeth_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(c, zero));
+            __m128i hi = paeth_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(c, zero));
+            return _mm_sub_epi8(r, _mm_packus_epi16(lo, hi));
+        }
+    }
+
+    return r;
+}
+
+#endif /* PNG_SSE2 */
+
+void filter_row(int type, const unsigned char *raw, const unsigned char *prior, size_t len, int bpp, unsigned char *out)
+{
+    size_t x = 0;
+
+    /* The first pixel has nothing on its left */
+    for (; x < len && x < (size_t)bpp; x++)
+    {
+        out[x] = filter_byte(type, raw, prior, x, bpp);
+    }
+
+#if defined(PNG_SSE2)
+    for (; x + 16 <= len; x += 16)
+    {
+        _mm_storeu_si128((__m128i *)(out + x), filter_16(type, raw, prior, x, bpp));
+    }
+#endif
+
+    for (; x < len; x++)
+    {
+        out[x] = filter_byte(type, raw, prior, x, bpp);
+    }
+}
+
+unsigned long filter_cost(const unsigned char *data, size_t len)
+{
+    unsigned long cost = 0;
+    size_t x = 0;
+
+#if defined(PNG_SSE2)
+    __m128i zero = _mm_setzero_si128();
+    __m128i sum = zero;
+
+    for (; x + 16 <= len; x += 16)
+    {
+        /* |signed byte| = min(byte, 256 - byte) */
+        __m128i v = _mm_loadu_si128((const __m128i *)(data + x));
+        v = _mm_min_epu8(v, _mm_sub_epi8(zero, v));
+        sum = _mm_add_epi64(sum, _mm_sad_epu8(v, zero));
+    }
+
+    /* Both 64-bit lanes in full: the low 32 bits alone wrap on rows over ~33 MB */
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, sum);
+    cost = (unsigned long)(lanes[0] + lanes[1]);
+#endif
+
+    for (; x < len; x++)
+    {
+        cost += (data[x] < 128) ? data[x] : 256 - data[x];
+    }
+
+    return cost;
+}
@@ -0,0 +1,21 @@
+/* Reference (PNG Specification, 9 Filtering):
+ * http://www.w3.org/TR/PNG/#9Filters
+ */
+
+#ifndef _FILTER_H_
+#define _FILTER_H_
+
+#include <stddef.h>
+
+/* Filter types of a scanline: 0 None, 1 Sub, 2 Up, 3 Average, 4 Paeth */
+#define FILTER_TYPES             (5)
+
+/* Filter len bytes of a scanline (without the filter type byte) into out
+ * raw, prior: unfiltered bytes of this and the previous scanline (all zero for the first one)
+ * bpp: bytes per complete pixel, 1 for bit depths below 8 */
+void filter_row(int type, const unsigned char *raw, const unsigned char *prior, size_t len, int bpp, unsigned char *out);
+
+/* Minimum sum of absolute differences heuristic: sum of the filtered bytes taken as signed, lower is better */
+unsigned long filter_cost(const unsigned char *data, size_t len);
+
+#endif /* _FILTER_H_ */
@@ -1,6 +1,10 @@
 #include "png.h"
+#include "deflate.h"
+#include "filter.h"
 #include "util.h"
+#include <climits>
 #include <cstring>
+#include <stdint.h>
 #include <fstream>
 using namespace std;
 
@@ -14,21 +18,26 @@ using namespace std;
 
 #define MIN(a, b) ((a) <= (b) ? (a) : (b))
 
-static union {char c[4]; unsigned long x;} endian_test = {{'l', '?', '?', 'b'}};
-#define ENDIANNESS ((char)endian_test.x)
+/* 4-byte length, type and CRC of each chunk */
+#define CHUNK_FIELDS 12
 
 
-/* Converts the unsigned integer from host byte order to network byte order. */
-unsigned long H2NL(unsigned long value)
+/* Writes the 4-byte unsigned integer in network byte order (big endian). */
+static void CONCAT32(char *&buff, unsigned long value)
 {
-    /* Byte order: little endian */
-    if ('l' == ENDIANNESS)
-    {
-        unsigned char *s = (unsigned char *)&value;
-        return (unsigned long)(s[0] << 24 | s[1] << 16 | s[2] << 8 | s[3]);
-    }
+    buff[0] = (char)((value >> 24) & 0xFF);
+    buff[1] = (char)((value >> 16) & 0xFF);
+    buff[2] = (char)((value >> 8) & 0xFF);
+    buff[3] = (char)(value & 0xFF);
+    buff += 4;
+}
 
-    return value;
+/* FLG of the zlib header: FLEVEL and FCHECK, (CMF*256 + FLG) is multiple of 31 */
+static unsigned char zlib_flg(unsigned char CMF, int FLEVEL, int FDICT)
+{
+    /* FCHECK = ((CMF*256 + (FLEVEL<<6) + (FDICT<<5) + 30)/31)*31 - CMF*256 - (FLEVEL<<6);
+     * FLG = (FLEVEL<<6) + (FDICT<<5) + FCHECK; */
+    return ((CMF*256 + (FLEVEL<<6) + (FDICT<<5) + 30)/31)*31 - CMF*256 + (FDICT<<5);
 }
 
 template <typename T>
@@ -47,6 +56,52 @@ static void CONCAT(char *&buff, T value, int len = 0)
 }
 
 
+/* Filters, compresses and checksums scanlines as they come, and writes IDAT chunks as soon as they are full
+ * Holds a few scanlines, the deflate window and less than a chunk of zlib bytes, whatever the image size. */
+class IDAT_STREAM
+{
+private:
+    PNG_IHDR IHDR;
+    PNG_IDAT IDAT;
+    unsigned long chunk_size;
+    /* Bytes of a scanline */
+    unsigned long stride;
+    DEFLATE deflate;
+    /* zlib bytes not yet written in an IDAT chunk */
+    vector<unsigned char> zlib;
+    /* Scanline: filter type byte + pixel data */
+    vector<char> row;
+    /* FILTER_TYPE, FILTER_ADAPTIVE only where it may help */
+    int filter;
+    /* Bytes per complete pixel (at least 1) */
+    int bpp;
+    /* Previous scanline unfiltered, filtered scanline, and the candidate being tried */
+    vector<char> prior;
+    vector<unsigned char> out;
+    vector<unsigned char> trial;
+
+public:
+    /* Where the datastream goes */
+    PNG_SINK sink;
+    /* Rows pushed so far */
+    unsigned long rows;
+
+    IDAT_STREAM(const PNG_SINK &sink, const PNG_IHDR &IHDR, const PNG_IDAT &IDAT, int level, unsigned long chunk_size, int filter);
+
+    /* data: a row of IHDR.width pixels */
+    void push_row(const void *data);
+
+    /* data: a row already packed as scanline pixel data, stride - 1 bytes */
+    void push_scanline(const unsigned char *data);
+
+    /* Filter, compress and checksum the scanline in row */
+    void write_row();
+
+    /* Flush the deflate stream, Adler32 and the last IDAT chunk */
+    void finish();
+};
+
+
 PNG_IHDR::PNG_IHDR()
 {
     length = 0x0D;
@@ -70,14 +125,8 @@ PNG_IDAT::PNG_IDAT()
 
     CMF = 0x78;
 
-    /* (CMF*256 + FLG) is multiple of 31 */
-    int FDICT, FLEVEL;
-
-    FDICT = 0;
-    FLEVEL = 3;
-    /* FCHECK = ((CMF*256 + (FLEVEL<<6) + (FDICT<<5) + 30)/31)*31 - CMF*256 - (FLEVEL<<6);
-     * FLG = (FLEVEL<<6) + (FDICT<<5) + FCHECK; */
-    FLG = ((CMF*256 + (FLEVEL<<6) + (FDICT<<5) + 30)/31)*31 - CMF*256 + (FDICT<<5);
+    /* FDICT = 0, FLEVEL = 2 (default algorithm) */
+    FLG = zlib_flg(CMF, 2, 0);
 
     idata = NULL;
     pdata = NULL;
@@ -123,6 +172,18 @@ int pixel_size(unsigned char color_type)
     return bytes;
 }
 
+PNG::PNG()
+{
+    level = DEFLATE_DEFAULT;
+    idat_size = IDAT_CHUNK_SIZE;
+    filter = FILTER_ADAPTIVE;
+}
+
+/* Out of line, where IDAT_STREAM is complete */
+PNG::~PNG()
+{
+}
+
 bool PNG::set_ihdr(unsigned long width, unsigned long height, BIT_DEPTH bit_depth, COLOR_TYPE color_type)
 {
     if (width == 0 || height == 0)
@@ -153,10 +214,12 @@ bool PNG::set_ihdr(unsigned long width, unsigned long height, BIT_DEPTH bit_dept
 
 bool PNG::set_plte(PIXEL *pixels, unsigned int count)
 {
-    if (NULL != pixels && count <= (1U << IHDR.bit_depth))
+    /* At most 256 entries, and no more than the bit depth can index */
+    if (NULL != pixels && count <= 256 && count <= (1U << IHDR.bit_depth))
     {
         /* Each a 3-byte series of the form: R/G/B */
         PLTE.length = count*3;
+        PLTE.palette.clear();
 
         for (unsigned int i = 0; i < count; i++)
         {
@@ -191,16 +254,15 @@ bool PNG::set_idat(unsigned char *data)
     return false;
 }
 
-void write_ihdr(ofstream &file, PNG_IHDR &IHDR)
+void write_ihdr(const PNG_SINK &sink, PNG_IHDR &IHDR)
 {
-    int ihdr_len = IHDR.length + sizeof(Chunk);
-    char *ihdr = new char[ihdr_len];
+    char ihdr[0x0D + CHUNK_FIELDS];
     char *buff = ihdr;
 
-    CONCAT(buff, H2NL(IHDR.length));
-    CONCAT(buff, H2NL(IHDR.type));
-    CONCAT(buff, H2NL(IHDR.width));
-    CONCAT(buff, H2NL(IHDR.height));
+    CONCAT32(buff, (IHDR.length));
+    CONCAT32(buff, (IHDR.type));
+    CONCAT32(buff, (IHDR.width));
+    CONCAT32(buff, (IHDR.height));
     CONCAT(buff, IHDR.bit_depth);
     CONCAT(buff, IHDR.color_type);
     CONCAT(buff, IHDR.compress_method);
@@ -208,22 +270,21 @@ void write_ihdr(ofstream &file, PNG_IHDR &IHDR)
     CONCAT(buff, IHDR.interlace_method);
 
     IHDR.CRC = CRC32(ihdr + 4, IHDR.length + 4);
-    CONCAT(buff, H2NL(IHDR.CRC));
+    CONCAT32(buff, (IHDR.CRC));
 
-    file.write(ihdr, ihdr_len);
-    delete [] ihdr;
+    sink((unsigned char *)ihdr, buff - ihdr);
 }
 
-void write_plte(ofstream &file, PNG_PLTE &PLTE)
+void write_plte(const PNG_SINK &sink, PNG_PLTE &PLTE)
 {
     if (PLTE.length)
     {
-        int plte_len = PLTE.length + sizeof(Chunk);
-        char *plte = new char[plte_len];
+        /* At most 256 entries */
+        char plte[256*3 + CHUNK_FIELDS];
         char *buff = plte;
 
-        CONCAT(buff, H2NL(PLTE.length));
-        CONCAT(buff, H2NL(PLTE.type));
+        CONCAT32(buff, (PLTE.length));
+        CONCAT32(buff, (PLTE.type));
         for (unsigned int i = 0; i < PLTE.palette.size(); i++)
         {
             CONCAT(buff, PLTE.palette[i].red);
@@ -232,161 +293,446 @@ void write_plte(ofstream &file, PNG_PLTE &PLTE)
         }
 
         PLTE.CRC = CRC32(plte + 4, PLTE.length + 4);
-        CONCAT(buff, H2NL(PLTE.CRC));
+        CONCAT32(buff, (PLTE.CRC));
 
-        file.write(plte, plte_len);
-        delete [] plte;
+        sink((unsigned char *)plte, buff - plte);
     }
 }
 
-void write_idat(ofstream &file, PNG_IHDR &IHDR, PNG_IDAT &IDAT)
+/* Write the zlib bytes at the front as IDAT chunks of chunk_size data bytes, keep the rest for later
+ * With last, the remaining bytes go out as well. chunk_size 0: no limit, everything goes out with last. */
+static void flush_idat(const PNG_SINK &sink, PNG_IDAT &IDAT, vector<unsigned char> &zlib, unsigned long chunk_size, bool last)
 {
-    int size = pixel_size(IHDR.color_type);
-    unsigned short len = IHDR.height*((IHDR.width*IHDR.bit_depth + 7)/8*size + 1);
+    size_t offset = 0;
 
-    IDAT.length = 7 + len + 4;
-    int idat_len = IDAT.length + sizeof(Chunk);
-    char *idat = new char[idat_len];
-    char *buff = idat;
+    while (offset < zlib.size())
+    {
+        size_t left = zlib.size() - offset;
 
-    CONCAT(buff, H2NL(IDAT.length));
-    CONCAT(buff, H2NL(IDAT.type));
+        if (chunk_size && left >= chunk_size)
+        {
+            IDAT.length = chunk_size;
+        }
+        else if (last)
+        {
+            IDAT.length = left;
+        }
+        else
+        {
+            break;
+        }
 
-    CONCAT(buff, IDAT.CMF);
-    CONCAT(buff, IDAT.FLG);
+        /* The data field is written and checksummed in place */
+        char head[8], tail[4];
+        char *buff = head;
 
-    NCB ucb;
-    ucb.header = 0x01;
-    ucb.LEN = len;
-    ucb.NLEN = len ^ 0xFFFF;
+        CONCAT32(buff, IDAT.length);
+        CONCAT32(buff, IDAT.type);
+
+        IDAT.CRC = crc32_update(0, head + 4, 4);
+        IDAT.CRC = crc32_update(IDAT.CRC, &zlib[offset], IDAT.length);
+        buff = tail;
+        CONCAT32(buff, IDAT.CRC);
+
+        sink((unsigned char *)head, 8);
+        sink(&zlib[offset], IDAT.length);
+        sink((unsigned char *)tail, 4);
+        offset += IDAT.length;
+    }
+
+    zlib.erase(zlib.begin(), zlib.begin() + offset);
+}
+
+/* 1-bit palette indexes, 8 per step: with each index in a byte of x (index k at bits 8k ~ 8k+7, low bit used),
+ * x*0x8040201008040201 gathers them in the top byte, index 0 in the highest bit, without carries */
+static void pack_1bpp(const unsigned char *idata, unsigned long width, unsigned char *out)
+{
+    unsigned long w = 0;
+
+    for (; w + 8 <= width; w += 8)
+    {
+        const unsigned char *p = idata + w;
+        uint64_t x = (uint64_t)p[0] | ((uint64_t)p[1] << 8) | ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24)
+                     | ((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40) | ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+
+        *out++ = (unsigned char)(((x & 0x0101010101010101ULL)*0x8040201008040201ULL) >> 56);
+    }
+
+    if (w < width)
+    {
+        unsigned char value = 0;
+
+        for (int i = 0; w < width; w++, i++)
+        {
+            value |= (idata[w] & 0x01) << (7 - i);
+        }
+        *out = value;
+    }
+}
+
+/* Scanline of a row of IHDR.width pixels: filter type byte + packed pixel data
+ * data: palette indexes for INDEXED_COLOR, PIXEL for the others */
+static void pack_row(const PNG_IHDR &IHDR, const void *data, char *buff)
+{
+    const unsigned char *idata = (const unsigned char *)data;
+    const PIXEL *pdata = (const PIXEL *)data;
 
-    CONCAT(buff, ucb.header);
-    CONCAT(buff, ucb.LEN);
-    CONCAT(buff, ucb.NLEN);
-    
     unsigned int groups = MIN(IHDR.width, (IHDR.width*IHDR.bit_depth + 7)/8);
     unsigned int each_group = MIN(IHDR.width, 8/IHDR.bit_depth);
 
     each_group = (each_group < 1) ? 1 : each_group;
 
-    for (unsigned int h = 0; h < IHDR.height; h++)
-    {
-        CONCAT(buff, 0x00, 1);
+    CONCAT(buff, 0x00, 1);
 
-        if (INDEXED_COLOR == IHDR.color_type)
+    if (INDEXED_COLOR == IHDR.color_type && BIT_DEPTH_1 == IHDR.bit_depth)
+    {
+        pack_1bpp(idata, IHDR.width, (unsigned char *)buff);
+    }
+    else if (INDEXED_COLOR == IHDR.color_type)
+    {
+        for (unsigned int w = 0; w < groups; w++)
         {
-            for (unsigned int w = 0; w < groups; w++)
+            unsigned char value = 0;
+            
+            for (unsigned int i = 0; i < each_group; i++)
             {
-                unsigned char value = 0;
-                
-                for (unsigned int i = 0; i < each_group; i++)
+                if (w*each_group + i < IHDR.width)
                 {
-                    if (w*each_group + i < IHDR.width)
-                    {
-                        value |= IDAT.idata[IHDR.width*h + w*each_group + i] << (8 - IHDR.bit_depth*(i + 1));
-                    }       
-                }
-                CONCAT(buff, value);
+                    value |= idata[w*each_group + i] << (8 - IHDR.bit_depth*(i + 1));
+                }       
             }
+            CONCAT(buff, value);
         }
-        else if (GREYSCALE == IHDR.color_type || ALPHA_GREYSCALE == IHDR.color_type)
+    }
+    else if (GREYSCALE == IHDR.color_type || ALPHA_GREYSCALE == IHDR.color_type)
+    {
+        for (unsigned int w = 0; w < groups; w++)
         {
-            for (unsigned int w = 0; w < groups; w++)
+            PIXEL pixel = {0, 0, 0, 0xFF};
+            unsigned char value = 0;
+            
+            for (unsigned int i = 0; i < each_group; i++)
             {
-                PIXEL pixel;
-                unsigned char value = 0;
-                
-                for (unsigned int i = 0; i < each_group; i++)
+                if (w*each_group + i < IHDR.width)
                 {
-                    if (w*each_group + i < IHDR.width)
+                    pixel = pdata[w*each_group + i];
+
+                    /* Gray = R*0.299 + G*0.587 + B*0.114 */
+                    unsigned char grey = (pixel.red*19595 + pixel.green*38469 + pixel.blue*7472) >> 16;
+
+                    if (IHDR.bit_depth < 8)
                     {
-                        pixel = IDAT.pdata[IHDR.width*h + w*each_group + i];
-
-                        /* Gray = R*0.299 + G*0.587 + B*0.114 */
-                        unsigned char grey = (pixel.red*19595 + pixel.green*38469 + pixel.blue*7472) >> 16;
-
-                        if (IHDR.bit_depth < 8)
-                        {
-                            grey = ((1 << IHDR.bit_depth) - 1)*grey/255;
-                            value |= grey << (8 - IHDR.bit_depth*(i + 1));
-                        }
-                        else
-                        {
-                            value = grey;
-                        }
+                        grey = ((1 << IHDR.bit_depth) - 1)*grey/255;
+                        value |= grey << (8 - IHDR.bit_depth*(i + 1));
+                    }
+                    else
+                    {
+                        value = grey;
                     }
                 }
-                CONCAT(buff, value, IHDR.bit_depth/8);
+            }
+            CONCAT(buff, value, IHDR.bit_depth/8);
 
-                if (ALPHA_GREYSCALE == IHDR.color_type)
-                {
-                    CONCAT(buff, pixel.alpha, IHDR.bit_depth/8);
-                }
+            if (ALPHA_GREYSCALE == IHDR.color_type)
+            {
+                CONCAT(buff, pixel.alpha, IHDR.bit_depth/8);
             }
         }
-        else if (TRUECOLOR == IHDR.color_type || ALPHA_TRUECOLOR == IHDR.color_type)
+    }
+    else if (TRUECOLOR == IHDR.color_type || ALPHA_TRUECOLOR == IHDR.color_type)
+    {
+        for (unsigned int w = 0; w < IHDR.width; w++)
+        {
+            CONCAT(buff, pdata[w].red, IHDR.bit_depth/8);
+            CONCAT(buff, pdata[w].green, IHDR.bit_depth/8);
+            CONCAT(buff, pdata[w].blue, IHDR.bit_depth/8);
+            if (ALPHA_TRUECOLOR == IHDR.color_type)
+            {
+                CONCAT(buff, pdata[w].alpha, IHDR.bit_depth/8);
+            }
+        }
+    }
+}
+
+IDAT_STREAM::IDAT_STREAM(const PNG_SINK &sink, const PNG_IHDR &IHDR, const PNG_IDAT &IDAT, int level, unsigned long chunk_size, int filter)
+    : IHDR(IHDR), IDAT(IDAT), chunk_size(chunk_size),
+      stride((IHDR.width*IHDR.bit_depth + 7)/8*pixel_size(IHDR.color_type) + 1),
+      deflate(level, stride), row(stride), filter(filter), sink(sink), rows(0)
+{
+    bpp = IHDR.bit_depth*pixel_size(IHDR.color_type)/8;
+    bpp = (bpp < 1) ? 1 : bpp;
+
+    /* Palette indexes and bit depths below 8 are best left unfiltered (PNG Specification 12.8) */
+    if (FILTER_ADAPTIVE == filter && (INDEXED_COLOR == IHDR.color_type || IHDR.bit_depth < 8))
+    {
+        this->filter = FILTER_NONE;
+    }
+
+    if (FILTER_NONE != this->filter)
+    {
+        /* The scanline before the first one is all zero */
+        prior.assign(stride, 0);
+        out.resize(stride);
+        trial.resize(stride);
+    }
+
+    /* zlib stream: CMF, FLG, deflate data, Adler32 of the scanlines */
+    int FLEVEL = (level <= DEFLATE_FASTEST) ? 0 : ((level < DEFLATE_DEFAULT) ? 1 : ((level == DEFLATE_DEFAULT) ? 2 : 3));
+
+    this->IDAT.FLG = zlib_flg(this->IDAT.CMF, FLEVEL, 0);
+    this->IDAT.ADLER32 = 1;
+    zlib.push_back(this->IDAT.CMF);
+    zlib.push_back(this->IDAT.FLG);
+}
+
+void IDAT_STREAM::push_row(const void *data)
+{
+    pack_row(IHDR, data, &row[0]);
+    write_row();
+}
+
+void IDAT_STREAM::push_scanline(const unsigned char *data)
+{
+    row[0] = 0x00;
+    memcpy(&row[1], data, stride - 1);
+    write_row();
+}
+
+void IDAT_STREAM::write_row()
+{
+    /* Filter type 0 leaves the packed scanline as it is */
+    const unsigned char *line = (unsigned char *)&row[0];
+
+    if (FILTER_NONE != filter)
+    {
+        const unsigned char *raw = (unsigned char *)&row[1];
+        const unsigned char *above = (unsigned char *)&prior[1];
+        size_t len = stride - 1;
+
+        if (FILTER_ADAPTIVE == filter)
         {
-            for (unsigned int w = 0; w < IHDR.width; w++)
+            /* The filter with the least sum of absolute differences */
+            unsigned long best = ULONG_MAX;
+
+            for (int type = FILTER_NONE; type < FILTER_TYPES; type++)
             {
-                CONCAT(buff, IDAT.pdata[IHDR.width*h + w].red, IHDR.bit_depth/8);
-                CONCAT(buff, IDAT.pdata[IHDR.width*h + w].green, IHDR.bit_depth/8);
-                CONCAT(buff, IDAT.pdata[IHDR.width*h + w].blue, IHDR.bit_depth/8);
-                if (ALPHA_TRUECOLOR == IHDR.color_type)
+                filter_row(type, raw, above, len, bpp, &trial[1]);
+                unsigned long cost = filter_cost(&trial[1], len);
+
+                if (cost < best)
                 {
-                    CONCAT(buff, IDAT.pdata[IHDR.width*h + w].alpha, IHDR.bit_depth/8);
+                    best = cost;
+                    trial[0] = (unsigned char)type;
+                    trial.swap(out);
                 }
             }
         }
+        else
+        {
+            out[0] = (unsigned char)filter;
+            filter_row(filter, raw, above, len, bpp, &out[1]);
+        }
+
+        line = &out[0];
+        prior.swap(row);
     }
 
-    IDAT.ADLER32 = Adler32((unsigned char *)idat + 15, IDAT.length - 11);
-    CONCAT(buff, H2NL(IDAT.ADLER32));
+    deflate.write(line, stride, zlib);
+    IDAT.ADLER32 = adler32_update(IDAT.ADLER32, line, stride);
+    rows++;
+
+    flush_idat(sink, IDAT, zlib, chunk_size, false);
+}
+
+void IDAT_STREAM::finish()
+{
+    deflate.finish(zlib);
 
-    IDAT.CRC = CRC32(idat + 4, IDAT.length + 4);
-    CONCAT(buff, H2NL(IDAT.CRC));
+    /* Adler32 in network byte order */
+    for (int shift = 24; shift >= 0; shift -= 8)
+    {
+        zlib.push_back((unsigned char)((IDAT.ADLER32 >> shift) & 0xFF));
+    }
 
-    file.write(idat, idat_len);
-    delete [] idat;
+    flush_idat(sink, IDAT, zlib, chunk_size, true);
 }
 
-void write_iend(ofstream &file, PNG_IEND png_iend)
+void write_iend(const PNG_SINK &sink, PNG_IEND png_iend)
 {
-    int iend_len = png_iend.length + sizeof(Chunk);
-    char *iend = new char[iend_len];
+    char iend[CHUNK_FIELDS];
     char *buff = iend;
 
-    CONCAT(buff, H2NL(png_iend.length));
-    CONCAT(buff, H2NL(png_iend.type));
-    CONCAT(buff, H2NL(png_iend.CRC));
+    CONCAT32(buff, (png_iend.length));
+    CONCAT32(buff, (png_iend.type));
+    CONCAT32(buff, (png_iend.CRC));
 
-    file.write(iend, iend_len);
-    delete [] iend;
+    sink((unsigned char *)iend, CHUNK_FIELDS);
 }
 
-bool PNG::write(char *path)
+void PNG::set_compression(int level)
 {
-    ofstream png_file(path, ios::out | ios::binary);
-    if (png_file.is_open())
+    this->level = (level < DEFLATE_STORED) ? DEFLATE_STORED : ((level > DEFLATE_BEST) ? DEFLATE_BEST : level);
+}
+
+void PNG::set_idat_size(unsigned long size)
+{
+    /* Chunk length is at most 2^31 - 1 */
+    this->idat_size = MIN(size, 0x7FFFFFFFUL);
+}
+
+size_t PNG::size_bound() const
+{
+    unsigned long stride = (IHDR.width*IHDR.bit_depth + 7)/8*pixel_size(IHDR.color_type) + 1;
+
+    /* zlib header, deflate data and Adler32 */
+    size_t zlib = 2 + DEFLATE::bound((size_t)IHDR.height*stride) + 4;
+    size_t chunks = idat_size ? (zlib + idat_size - 1)/idat_size : 1;
+
+    size_t size = 8 + (IHDR.length + CHUNK_FIELDS) + zlib + chunks*CHUNK_FIELDS + CHUNK_FIELDS;
+
+    if (PLTE.length)
     {
-        /* png file signature */
-        png_file.write(PNG_FILE_SIGNATURE, 8);
+        size += PLTE.length + CHUNK_FIELDS;
+    }
 
-        /* IHDR */
-        write_ihdr(png_file, IHDR);
+    return size;
+}
 
-        /* PLTE */
-        write_plte(png_file, PLTE);
+bool PNG::begin(const PNG_SINK &sink)
+{
+    /* One datastream at a time: finish the open one first */
+    if (0 == IHDR.width || stream)
+    {
+        return false;
+    }
 
-        /* IDAT */
-        write_idat(png_file, IHDR, IDAT);
+    /* png file signature */
+    sink((const unsigned char *)PNG_FILE_SIGNATURE, 8);
 
-        /* IEND */
-        write_iend(png_file, IEND);
+    /* IHDR */
+    write_ihdr(sink, IHDR);
+
+    /* PLTE */
+    write_plte(sink, PLTE);
+
+    /* IDAT, written as rows are pushed */
+    stream.reset(new IDAT_STREAM(sink, IHDR, IDAT, level, idat_size, filter));
+
+    return true;
+}
+
+bool PNG::push_row(const PIXEL *row)
+{
+    if (!stream || NULL == row || INDEXED_COLOR == IHDR.color_type || stream->rows >= IHDR.height)
+    {
+        return false;
+    }
+
+    stream->push_row(row);
+    return true;
+}
+
+bool PNG::push_row(const unsigned char *row)
+{
+    if (!stream || NULL == row || INDEXED_COLOR != IHDR.color_type || stream->rows >= IHDR.height)
+    {
+        return false;
+    }
+
+    stream->push_row(row);
+    return true;
+}
+
+bool PNG::push_scanline(const unsigned char *scanline)
+{
+    if (!stream || NULL == scanline || stream->rows >= IHDR.height)
+    {
+        return false;
+    }
+
+    stream->push_scanline(scanline);
+    return true;
+}
+
+bool PNG::finish()
+{
+    if (!stream || stream->rows != IHDR.height)
+    {
+        return false;
+    }
+
+    stream->finish();
+
+    /* IEND */
+    write_iend(stream->sink, IEND);
+
+    stream.reset();
+
+    return true;
+}
+
+bool PNG::write_to(const PNG_SINK &sink)
+{
+    if (NULL == IDAT.idata || !begin(sink))
+    {
+        return false;
+    }
+
+    for (unsigned long h = 0; h < IHDR.height; h++)
+    {
+        if (INDEXED_COLOR == IHDR.color_type)
+        {
+            push_row(IDAT.idata + IHDR.width*h);
+        }
+        else
+        {
+            push_row(IDAT.pdata + IHDR.width*h);
+        }
+    }
+
+    return finish();
+}
+
+bool PNG::write_to(vector<unsigned char> &out)
+{
+    /* Stored data is within a few bytes of the bound: a single allocation.
+     * The compressed size is only known once written, reserving the bound would over-allocate by the compression ratio. */
+    if (DEFLATE_STORED == level)
+    {
+        out.reserve(out.size() + size_bound());
+    }
+
+    return write_to([&out](const unsigned char *data, size_t len)
+    {
+        out.insert(out.end(), data, data + len);
+    });
+}
+
+void PNG::set_filter(FILTER_TYPE filter)
+{
+    this->filter = filter;
+}
+
+bool PNG::write(char *path)
+{
+    /* Leave the file alone if a stream is open */
+    if (stream)
+    {
+        return false;
+    }
+
+    ofstream png_file(path, ios::out | ios::binary);
+    if (png_file.is_open())
+    {
+        bool done = write_to([&png_file](const unsigned char *data, size_t len)
+        {
+            png_file.write((const char *)data, len);
+        });
 
         png_file.close();
 
-        return true;
+        return done;
     }
 
     return false;
-}
\ No newline at end of file
+}
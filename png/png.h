@@ -7,9 +7,15 @@
 #ifndef _PNG_H_
 #define _PNG_H_
 
+#include <stddef.h>
+#include <functional>
+#include <memory>
 #include <vector>
 using std::vector;
 
+/* Receives the png datastream piece by piece, in order */
+typedef std::function<void(const unsigned char *data, size_t len)> PNG_SINK;
+
 typedef enum
 {
     BIT_DEPTH_1 = 1,
@@ -33,6 +39,19 @@ typedef enum
     ALPHA_TRUECOLOR = 6
 }COLOR_TYPE;
 
+/* Filter type of each scanline */
+typedef enum
+{
+    FILTER_NONE = 0,
+    FILTER_SUB = 1,
+    FILTER_UP = 2,
+    FILTER_AVERAGE = 3,
+    FILTER_PAETH = 4,
+    /* Per scanline, the filter with the minimum sum of absolute differences,
+     * none for indexed color and bit depths below 8 */
+    FILTER_ADAPTIVE = 5
+}FILTER_TYPE;
+
 typedef struct
 {
     unsigned char red;
@@ -41,20 +60,6 @@ typedef struct
     unsigned char alpha;
 }PIXEL;
 
-/* Non-compressed blocks (BTYPE=00) */
-typedef struct
-{
-    /* Each block of compressed data begins with 3 header bits
-     * bit 0: BFINAL (set if and only if this is the last block of the data set)
-     * bit 1~2: BTYPE (set to 00 if no compression) */
-    unsigned char header;
-    /* LEN is the number of data bytes in the block */
-    unsigned short LEN;
-    /* NLEN is the complement of LEN */
-    unsigned short NLEN;
-}NCB;
-
-
 class Chunk
 {
 public:
@@ -130,6 +135,11 @@ public:
 };
 
 
+/* Default max data bytes of each IDAT chunk */
+#define IDAT_CHUNK_SIZE          (65536)
+
+class IDAT_STREAM;
+
 /* A valid PNG image must contain an IHDR chunk, one or more IDAT chunks, and an IEND chunk. */
 class PNG
 {
@@ -138,8 +148,20 @@ private:
     PNG_PLTE PLTE;
     PNG_IDAT IDAT;
     PNG_IEND IEND;
+    /* DEFLATE level of the image data (0~9) */
+    int level;
+    /* Max data bytes of each IDAT chunk, 0: a single IDAT chunk */
+    unsigned long idat_size;
+    /* Filter type of the scanlines */
+    FILTER_TYPE filter;
+    /* Image data being written row by row, between begin and finish
+     * Owned by this PNG only: PNG is not copyable, copies would share one deflate and CRC state. */
+    std::unique_ptr<IDAT_STREAM> stream;
 
 public:
+    PNG();
+    ~PNG();
+
     /* Set IHDR: png image width, height, bit depth and color type */
     bool set_ihdr(unsigned long width, unsigned long height,
                   BIT_DEPTH bit_depth = BIT_DEPTH_4, COLOR_TYPE color_type = INDEXED_COLOR);
@@ -153,8 +175,46 @@ public:
     /* Set IDAT: indexed color data, for INDEXED_COLOR */
     bool set_idat(unsigned char *data);
 
+    /* Set compression level of IDAT: DEFLATE_STORED (0) ~ DEFLATE_BEST (9), default DEFLATE_DEFAULT (6) */
+    void set_compression(int level);
+
+    /* Set max data bytes of each IDAT chunk, default IDAT_CHUNK_SIZE, 0: the whole zlib stream in one chunk */
+    void set_idat_size(unsigned long size);
+
+    /* Set filter type of the scanlines, default FILTER_ADAPTIVE */
+    void set_filter(FILTER_TYPE filter);
+
+    /* Max bytes of the png datastream with the current settings, the size of the image stored without compression
+     * Close to the actual size only for DEFLATE_STORED, compressed images are usually many times smaller. */
+    size_t size_bound() const;
+
     /* Save .png file to the path */
     bool write(char *path);
+
+    /* Append the png datastream to out */
+    bool write_to(vector<unsigned char> &out);
+
+    /* Pass the png datastream to sink, chunk by chunk */
+    bool write_to(const PNG_SINK &sink);
+
+    /* Streaming output, rows are passed one at a time instead of set_idat:
+     * begin writes the signature, IHDR and PLTE to sink (set them first),
+     * push_row encodes the next row of IHDR.width pixels, top to bottom,
+     * finish writes the rest once all IHDR.height rows are in.
+     * begin (and write, write_to) fails while a stream is open, until finish succeeds. */
+    bool begin(const PNG_SINK &sink);
+
+    /* Next row of pixel color data */
+    bool push_row(const PIXEL *row);
+
+    /* Next row of indexed color data, for INDEXED_COLOR */
+    bool push_row(const unsigned char *row);
+
+    /* Next row already packed as in the file, without the filter type byte:
+     * ((width*bit_depth + 7)/8)*(samples per pixel) bytes, eg: 8 pixels per byte, leftmost in the high bit, for BIT_DEPTH_1 indexed color */
+    bool push_scanline(const unsigned char *scanline);
+
+    bool finish();
 };
 
 #endif /* _PNG_H_ */
\ No newline at end of file
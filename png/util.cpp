@@ -1,4 +1,8 @@
-#define INIT  0xFFFFFFFF
+#include "util.h"
+#include "../simd.h"
+#include <stddef.h>
+#include <stdint.h>
+
 #define XOROT 0xFFFFFFFF
 
 static const unsigned long CRC32_Table[256] =
@@ -69,42 +73,288 @@ static const unsigned long CRC32_Table[256] =
    0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D
 };
 
-unsigned long CRC32(void *buf, long len)
+#if defined(QR_X86_SIMD)
+
+/* Carry-less multiply folding (Intel, "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction")
+ * Four 128-bit lanes are folded 64 bytes at a time, then into one lane, then Barrett reduced to 32 bits.
+ * Constants are x^n mod P in the bit-reflected domain, len >= 64 and a multiple of 16. */
+QR_TARGET("pclmul,sse2")
+static uint32_t crc32_pclmul(uint32_t crc, const unsigned char *buf, size_t len)
+{
+    const __m128i k1k2 = _mm_set_epi64x(0x01C6E41596LL, 0x0154442BD4LL);
+    const __m128i k3k4 = _mm_set_epi64x(0x00CCAA009ELL, 0x01751997D0LL);
+    const __m128i k5k0 = _mm_set_epi64x(0, 0x0163CD6124LL);
+    const __m128i poly = _mm_set_epi64x(0x01F7011641LL, 0x01DB710641LL);
+    const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+
+    __m128i x1 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+    __m128i x2 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+    __m128i x3 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+    __m128i x4 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+    __m128i x5;
+
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+    buf += 64;
+    len -= 64;
+
+    /* Fold 4 lanes by 512 bits */
+    while (len >= 64)
+    {
+        __m128i x6, x7, x8;
+
+        x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+
+        x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i *)(buf + 0x00)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i *)(buf + 0x10)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i *)(buf + 0x20)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i *)(buf + 0x30)));
+
+        buf += 64;
+        len -= 64;
+    }
+
+    /* Fold the 4 lanes into one by 128 bits */
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    /* Remaining 16-byte blocks */
+    while (len >= 16)
+    {
+        x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128((const __m128i *)buf)), x5);
+
+        buf += 16;
+        len -= 16;
+    }
+
+    /* 128 bits to 64 bits */
+    x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, mask32);
+    x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    /* Barrett reduction to 32 bits */
+    x2 = _mm_and_si128(x1, mask32);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+    x2 = _mm_and_si128(x2, mask32);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(x1, 4));
+}
+
+#endif /* QR_X86_SIMD */
+
+/* Slicing-by-8 tables: table[k][n] is the CRC of byte n followed by k zero bytes */
+typedef struct
+{
+    uint32_t table[8][256];
+}CRC32_SLICES;
+
+static const CRC32_SLICES &crc32_slices()
+{
+    static const CRC32_SLICES slices = []()
+    {
+        CRC32_SLICES s;
+
+        for (int n = 0; n < 256; n++)
+        {
+            s.table[0][n] = (uint32_t)CRC32_Table[n];
+        }
+
+        for (int k = 1; k < 8; k++)
+        {
+            for (int n = 0; n < 256; n++)
+            {
+                s.table[k][n] = (s.table[k - 1][n] >> 8) ^ s.table[0][s.table[k - 1][n] & 0xFF];
+            }
+        }
+
+        return s;
+    }();
+
+    return slices;
+}
+
+/* 8 bytes per step, bytes are assembled in little endian order so the host byte order does not matter */
+static uint32_t crc32_slicing(uint32_t crc, const unsigned char *buf, size_t len)
 {
-    unsigned long CRC_value;
-    unsigned char *pData;
+    const uint32_t (*t)[256] = crc32_slices().table;
+
+    while (len >= 8)
+    {
+        uint32_t lo = crc ^ (buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((uint32_t)buf[3] << 24));
+        uint32_t hi = buf[4] | (buf[5] << 8) | (buf[6] << 16) | ((uint32_t)buf[7] << 24);
+
+        crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24]
+              ^ t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
 
-    /* init the start value */
-    CRC_value = INIT;
-    pData = (unsigned char *)buf;
+        buf += 8;
+        len -= 8;
+    }
 
-    /* calculate CRC */
     while (len--)
     {
-        CRC_value = CRC32_Table[(CRC_value ^ *pData++) & 0xFF] ^ (CRC_value >> 8);
+        crc = t[0][(crc ^ *buf++) & 0xFF] ^ (crc >> 8);
+    }
+
+    return crc;
+}
+
+unsigned long crc32_update(unsigned long crc, const void *buf, long len)
+{
+    const unsigned char *pData = (const unsigned char *)buf;
+    size_t left = (len > 0) ? (size_t)len : 0;
+
+    /* Undo the output XOR of the previous CRC, 0 gives the init value */
+    uint32_t CRC_value = (uint32_t)(crc ^ XOROT);
+
+#if defined(QR_X86_SIMD)
+    if (left >= 64 && cpu_has_pclmul())
+    {
+        size_t n = left & ~(size_t)15;
+
+        CRC_value = crc32_pclmul(CRC_value, pData, n);
+        pData += n;
+        left -= n;
     }
+#endif
+
+    CRC_value = crc32_slicing(CRC_value, pData, left);
+
     /* XOR the output value */
     return CRC_value ^ XOROT;
 }
 
+unsigned long CRC32(void *buf, long len)
+{
+    return crc32_update(0, buf, len);
+}
+
 
 #define BASE 65521
+/* Largest n such that 255*n*(n + 1)/2 + (n + 1)*(BASE - 1) fits in 32 bits: s2 may go that long without a modulo */
+#define NMAX 5552
+
+#if defined(QR_X86_SIMD)
+
+/* 32 bytes per step: s1 gains the byte sum (PSADBW), s2 gains 32*s1 plus the bytes weighted 32 ~ 1 (PMADDUBSW)
+ * Reduces modulo BASE once every NMAX bytes, leaves len % 32 bytes to the caller. */
+QR_TARGET("ssse3")
+static void adler32_ssse3(uint32_t &s1, uint32_t &s2, const unsigned char *&buf, size_t &len)
+{
+    const __m128i tap1 = _mm_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17);
+    const __m128i tap2 = _mm_setr_epi8(16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi16(1);
+    size_t blocks = len/32;
+
+    len -= blocks*32;
 
-unsigned long update_adler32(unsigned long adler, unsigned char *buf, int len)
+    while (blocks)
+    {
+        size_t n = (blocks < NMAX/32) ? blocks : NMAX/32;
+        blocks -= n;
+
+        /* v_ps: sum of s1 before each step, v_s1: byte sum, v_s2: weighted sum */
+        __m128i v_ps = _mm_cvtsi32_si128((int)(s1*n));
+        __m128i v_s1 = _mm_setzero_si128();
+        __m128i v_s2 = _mm_cvtsi32_si128((int)s2);
+
+        do
+        {
+            __m128i bytes1 = _mm_loadu_si128((const __m128i *)buf);
+            __m128i bytes2 = _mm_loadu_si128((const __m128i *)(buf + 16));
+
+            v_ps = _mm_add_epi32(v_ps, v_s1);
+            v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes1, zero));
+            v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_maddubs_epi16(bytes1, tap1), ones));
+            v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes2, zero));
+            v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_maddubs_epi16(bytes2, tap2), ones));
+
+            buf += 32;
+        } while (--n);
+
+        v_s2 = _mm_add_epi32(v_s2, _mm_slli_epi32(v_ps, 5));
+
+        /* Horizontal sums */
+        v_s1 = _mm_add_epi32(v_s1, _mm_shuffle_epi32(v_s1, _MM_SHUFFLE(2, 3, 0, 1)));
+        v_s1 = _mm_add_epi32(v_s1, _mm_shuffle_epi32(v_s1, _MM_SHUFFLE(1, 0, 3, 2)));
+        v_s2 = _mm_add_epi32(v_s2, _mm_shuffle_epi32(v_s2, _MM_SHUFFLE(2, 3, 0, 1)));
+        v_s2 = _mm_add_epi32(v_s2, _mm_shuffle_epi32(v_s2, _MM_SHUFFLE(1, 0, 3, 2)));
+
+        s1 = (s1 + (uint32_t)_mm_cvtsi128_si32(v_s1)) % BASE;
+        s2 = (uint32_t)_mm_cvtsi128_si32(v_s2) % BASE;
+    }
+}
+
+#endif /* QR_X86_SIMD */
+
+unsigned long adler32_update(unsigned long adler, const unsigned char *buf, size_t len)
 {
-    unsigned long s1 = adler & 0xFFFF;
-    unsigned long s2 = (adler >> 16) & 0xFFFF;
-    int n;
+    uint32_t s1 = adler & 0xFFFF;
+    uint32_t s2 = (adler >> 16) & 0xFFFF;
+
+#if defined(QR_X86_SIMD)
+    if (len >= 64 && cpu_has_ssse3())
+    {
+        adler32_ssse3(s1, s2, buf, len);
+    }
+#endif
 
-    for (n = 0; n < len; n++)
+    /* Modulo once every NMAX bytes instead of every byte */
+    while (len > 0)
     {
-        s1 = (s1 + buf[n]) % BASE;
-        s2 = (s2 + s1)     % BASE;
+        size_t n = (len < NMAX) ? len : NMAX;
+        len -= n;
+
+        for (; n >= 8; n -= 8, buf += 8)
+        {
+            s1 += buf[0]; s2 += s1;
+            s1 += buf[1]; s2 += s1;
+            s1 += buf[2]; s2 += s1;
+            s1 += buf[3]; s2 += s1;
+            s1 += buf[4]; s2 += s1;
+            s1 += buf[5]; s2 += s1;
+            s1 += buf[6]; s2 += s1;
+            s1 += buf[7]; s2 += s1;
+        }
+
+        for (; n > 0; n--)
+        {
+            s1 += *buf++;
+            s2 += s1;
+        }
+
+        s1 %= BASE;
+        s2 %= BASE;
     }
-    return (s2 << 16) + s1;
+
+    return ((unsigned long)s2 << 16) + s1;
 }
 
 unsigned long Adler32(unsigned char *buf, int len)
 {
-    return update_adler32(1L, buf, len);
-}
\ No newline at end of file
+    return adler32_update(1L, buf, (len > 0) ? len : 0);
+}
@@ -1,8 +1,16 @@
 #ifndef _UTIL_H_
 #define _UTIL_H_
 
+#include <stddef.h>
+
 unsigned long CRC32(void *buf, long len);
 
+/* CRC32 continued over len more bytes, crc: CRC32 of the preceding bytes (0 for none) */
+unsigned long crc32_update(unsigned long crc, const void *buf, long len);
+
+/* Adler32 continued over len more bytes, adler: Adler32 of the preceding bytes (1 for none) */
+unsigned long adler32_update(unsigned long adler, const unsigned char *buf, size_t len);
+
 unsigned long Adler32(unsigned char *buf, int len);
 
 #endif /* _UTIL_H_ */
\ No newline at end of file
@@ -0,0 +1,220 @@
+#include "render.h"
+#include "png/png.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+/* Max png image width and height: 2^31 - 1 (PNG Specification 11.2.2) */
+#define PNG_MAX_SIDE             (0x7FFFFFFFULL)
+/* Largest scale widened by table (256*scale bytes), larger modules are filled a run of bits at a time */
+#define LUT_MAX_SCALE            (32)
+
+/* 1-bit indexed png header of the symbol: scale*scale pixels per module, quiet_zone light modules on each side */
+static bool symbol_png(const QR_SYMBOL &symbol, int scale, int quiet_zone, PNG &qr_png)
+{
+    if (!symbol.valid() || scale < 1 || quiet_zone < 0)
+    {
+        return false;
+    }
+
+    /* In 64 bits, before anything is computed in int */
+    if ((symbol.size + 2ULL*quiet_zone)*scale > PNG_MAX_SIDE)
+    {
+        return false;
+    }
+
+    unsigned long width = (unsigned long)(symbol.size + 2*quiet_zone)*scale;
+
+    qr_png.set_ihdr(width, width, BIT_DEPTH_1, INDEXED_COLOR);
+
+    PIXEL pixels[] = {{0xFF, 0xFF, 0xFF, 0xFF}, {0, 0, 0, 0xFF}};
+    qr_png.set_plte(pixels, 2);
+
+    return true;
+}
+
+/* Module row x, 1 bit per module after quiet_zone light modules, leftmost in the high bit as png packs them
+ * Columns are already stored that way, MSB first in 64-bit words, so the row is copied a byte at a time
+ * (shifted if quiet_zone is not a multiple of 8) instead of being rebuilt module by module. */
+static void pack_modules(const BIT_MATRIX &matrix, int x, int quiet_zone, vector<unsigned char> &packed)
+{
+    const uint64_t *row = matrix.row(x);
+    int shift = quiet_zone % 8;
+    size_t first = quiet_zone/8;
+
+    std::fill(packed.begin(), packed.end(), 0);
+
+    for (int w = 0; w < matrix.words; w++)
+    {
+        uint64_t word = row[w];
+
+        /* Columns past the symbol are light */
+        if (w == matrix.words - 1 && (matrix.size % 64))
+        {
+            word &= ~0ULL << (64 - matrix.size % 64);
+        }
+
+        for (int b = 0; b < 8 && w*64 + b*8 < matrix.size; b++)
+        {
+            unsigned char byte = (unsigned char)(word >> (56 - 8*b));
+            size_t i = first + w*8 + b;
+
+            packed[i] |= byte >> shift;
+
+            if (shift && i + 1 < packed.size())
+            {
+                packed[i + 1] |= (unsigned char)(byte << (8 - shift));
+            }
+        }
+    }
+}
+
+/* Set bits [start, start + count) of a 1-bit scanline, MSB first */
+static void set_bits(unsigned char *scanline, size_t start, size_t count)
+{
+    size_t end = start + count;
+
+    for (; start < end && (start % 8); start++)
+    {
+        scanline[start/8] |= 0x80 >> (start % 8);
+    }
+
+    if (end - start >= 8)
+    {
+        memset(scanline + start/8, 0xFF, (end - start)/8);
+        start += (end - start)/8*8;
+    }
+
+    for (; start < end; start++)
+    {
+        scanline[start/8] |= 0x80 >> (start % 8);
+    }
+}
+
+/* Stream the rows of the symbol to qr_png
+ * Each module row is packed to 1 bit per module once (quiet zone included), widened by a table that maps
+ * a byte of 8 modules to the scale bytes of their pixels, and the scanline is pushed scale times.
+ * Above LUT_MAX_SCALE the table would take 256*scale bytes, each dark module is set as a run of scale bits instead
+ * (at least 33 bits, mostly whole bytes). */
+static bool symbol_rows(const QR_SYMBOL &symbol, int scale, int quiet_zone, PNG &qr_png, const PNG_SINK &sink)
+{
+    int modules = symbol.size + 2*quiet_zone;
+    size_t packed_len = (modules + 7)/8;
+
+    /* lut[v*scale ~ v*scale + scale - 1]: the 8 bits of v, each repeated scale times, MSB first */
+    vector<unsigned char> lut((scale <= LUT_MAX_SCALE) ? 256*scale : 0, 0);
+
+    for (int v = 0; v < 256 && !lut.empty(); v++)
+    {
+        for (int k = 0; k < 8; k++)
+        {
+            if (v & (0x80 >> k))
+            {
+                for (int bit = k*scale; bit < (k + 1)*scale; bit++)
+                {
+                    lut[v*scale + bit/8] |= 0x80 >> (bit % 8);
+                }
+            }
+        }
+    }
+
+    /* Padding bits are light */
+    vector<unsigned char> packed(packed_len);
+    vector<unsigned char> scanline(packed_len*scale, 0);
+
+    if (!qr_png.begin(sink))
+    {
+        return false;
+    }
+
+    /* Quiet zone above */
+    for (int i = 0; i < quiet_zone*scale; i++)
+    {
+        qr_png.push_scanline(&scanline[0]);
+    }
+
+    for (int x = 0; x < symbol.size; x++)
+    {
+        pack_modules(symbol.modules, x, quiet_zone, packed);
+
+        /* 1 pixel per module: the packed row is the scanline */
+        if (1 == scale)
+        {
+            qr_png.push_scanline(&packed[0]);
+            continue;
+        }
+
+        if (!lut.empty())
+        {
+            for (size_t i = 0; i < packed_len; i++)
+            {
+                memcpy(&scanline[i*scale], &lut[packed[i]*scale], scale);
+            }
+        }
+        else
+        {
+            std::fill(scanline.begin(), scanline.end(), 0);
+
+            for (int y = 0; y < symbol.size; y++)
+            {
+                if (symbol.module(x, y))
+                {
+                    set_bits(&scanline[0], (size_t)(quiet_zone + y)*scale, scale);
+                }
+            }
+        }
+
+        for (int i = 0; i < scale; i++)
+        {
+            qr_png.push_scanline(&scanline[0]);
+        }
+    }
+
+    /* Quiet zone below */
+    std::fill(scanline.begin(), scanline.end(), 0);
+
+    for (int i = 0; i < quiet_zone*scale; i++)
+    {
+        qr_png.push_scanline(&scanline[0]);
+    }
+
+    return qr_png.finish();
+}
+
+bool render_png(const QR_SYMBOL &symbol, char *path, int scale, int quiet_zone)
+{
+    PNG qr_png;
+
+    if (!symbol_png(symbol, scale, quiet_zone, qr_png))
+    {
+        return false;
+    }
+
+    std::ofstream png_file(path, std::ios::out | std::ios::binary);
+
+    if (!png_file.is_open())
+    {
+        return false;
+    }
+
+    return symbol_rows(symbol, scale, quiet_zone, qr_png, [&png_file](const unsigned char *data, size_t len)
+    {
+        png_file.write((const char *)data, len);
+    });
+}
+
+bool render_png(const QR_SYMBOL &symbol, vector<unsigned char> &out, int scale, int quiet_zone)
+{
+    PNG qr_png;
+
+    if (!symbol_png(symbol, scale, quiet_zone, qr_png))
+    {
+        return false;
+    }
+
+    /* No reserve: symbols compress far below size_bound (eg: 170x at scale 200), out grows as chunks come */
+    return symbol_rows(symbol, scale, quiet_zone, qr_png, [&out](const unsigned char *data, size_t len)
+    {
+        out.insert(out.end(), data, data + len);
+    });
+}
@@ -0,0 +1,13 @@
+#ifndef _RENDER_H_
+#define _RENDER_H_
+
+#include "QR.h"
+
+/* Save symbol as png file to the path
+ * scale: pixels per module side, quiet_zone: light modules around the symbol (4 recommended by ISO/IEC 18004) */
+bool render_png(const QR_SYMBOL &symbol, char *path, int scale = 1, int quiet_zone = 0);
+
+/* Append the png datastream of symbol to out */
+bool render_png(const QR_SYMBOL &symbol, vector<unsigned char> &out, int scale = 1, int quiet_zone = 0);
+
+#endif /* _RENDER_H_ */
@@ -0,0 +1,414 @@
+#include "rs.h"
+#include "simd.h"
+#include <stddef.h>
+#include <string.h>
+
+/* GF(2^8): Galois field
+ * Prime modulus polynomical, P(α) = α^8+α^4+α^3+α^2+1 = 0;
+ * => α^8 = α^4+α^3+α^2+1 = 29 (00011101)
+ */
+
+/* Y = GF_INT[X]: Y = α^X */
+static const unsigned char GF_INT[256] =
+{
+      1,   2,   4,   8,  16,  32,  64, 128,  29,  58, 116, 232, 205, 135,  19,  38,
+     76, 152,  45,  90, 180, 117, 234, 201, 143,   3,   6,  12,  24,  48,  96, 192,
+    157,  39,  78, 156,  37,  74, 148,  53, 106, 212, 181, 119, 238, 193, 159,  35,
+     70, 140,   5,  10,  20,  40,  80, 160,  93, 186, 105, 210, 185, 111, 222, 161,
+     95, 190,  97, 194, 153,  47,  94, 188, 101, 202, 137,  15,  30,  60, 120, 240,
+    253, 231, 211, 187, 107, 214, 177, 127, 254, 225, 223, 163,  91, 182, 113, 226,
+    217, 175,  67, 134,  17,  34,  68, 136,  13,  26,  52, 104, 208, 189, 103, 206,
+    129,  31,  62, 124, 248, 237, 199, 147,  59, 118, 236, 197, 151,  51, 102, 204,
+    133,  23,  46,  92, 184, 109, 218, 169,  79, 158,  33,  66, 132,  21,  42,  84,
+    168,  77, 154,  41,  82, 164,  85, 170,  73, 146,  57, 114, 228, 213, 183, 115,
+    230, 209, 191,  99, 198, 145,  63, 126, 252, 229, 215, 179, 123, 246, 241, 255,
+    227, 219, 171,  75, 150,  49,  98, 196, 149,  55, 110, 220, 165,  87, 174,  65,
+    130,  25,  50, 100, 200, 141,   7,  14,  28,  56, 112, 224, 221, 167,  83, 166,
+     81, 162,  89, 178, 121, 242, 249, 239, 195, 155,  43,  86, 172,  69, 138,   9,
+     18,  36,  72, 144,  61, 122, 244, 245, 247, 243, 251, 235, 203, 139,  11,  22,
+     44,  88, 176, 125, 250, 233, 207, 131,  27,  54, 108, 216, 173,  71, 142,   1
+};
+
+/* Y = GF_EXP[X]: X = α^Y */
+static const unsigned char GF_EXP[256] =
+{
+      0,   0,   1,  25,   2,  50,  26, 198,   3, 223,  51, 238,  27, 104, 199,  75,
+      4, 100, 224,  14,  52, 141, 239, 129,  28, 193, 105, 248, 200,   8,  76, 113,
+      5, 138, 101,  47, 225,  36,  15,  33,  53, 147, 142, 218, 240,  18, 130,  69,
+     29, 181, 194, 125, 106,  39, 249, 185, 201, 154,   9, 120,  77, 228, 114, 166,
+      6, 191, 139,  98, 102, 221,  48, 253, 226, 152,  37, 179,  16, 145,  34, 136,
+     54, 208, 148, 206, 143, 150, 219, 189, 241, 210,  19,  92, 131,  56,  70,  64,
+     30,  66, 182, 163, 195,  72, 126, 110, 107,  58,  40,  84, 250, 133, 186,  61,
+    202,  94, 155, 159,  10,  21, 121,  43,  78, 212, 229, 172, 115, 243, 167,  87,
+      7, 112, 192, 247, 140, 128,  99,  13, 103,  74, 222, 237,  49, 197, 254,  24,
+    227, 165, 153, 119,  38, 184, 180, 124,  17,  68, 146, 217,  35,  32, 137,  46,
+     55,  63, 209,  91, 149, 188, 207, 205, 144, 135, 151, 178, 220, 252, 190,  97,
+    242,  86, 211, 171,  20,  42,  93, 158, 132,  60,  57,  83,  71, 109,  65, 162,
+     31,  45,  67, 216, 183, 123, 164, 118, 196,  23,  73, 236, 127,  12, 111, 246,
+    108, 161,  59,  82,  41, 157,  85, 170, 251,  96, 134, 177, 187, 204,  62,  90,
+    203,  89,  95, 176, 156, 169, 160,  81,  11, 245,  22, 235, 122, 117,  44, 215,
+     79, 174, 213, 233, 230, 231, 173, 232, 116, 214, 244, 234, 168,  80,  88, 175
+};
+
+/* Generator polynomials for Reed-Solomon error correction codewords */
+static const unsigned char GP_7[]  = { 87, 229, 146, 149, 238, 102,  21};
+static const unsigned char GP_10[] = {251,  67,  46,  61, 118,  70,  64,  94,  32,  45};
+static const unsigned char GP_13[] = { 74, 152, 176, 100,  86, 100, 106, 104, 130, 218, 206, 140,  78};
+static const unsigned char GP_15[] = {  8, 183,  61,  91, 202,  37,  51,  58,  58, 237, 140, 124,   5,  99, 105};
+static const unsigned char GP_16[] = {120, 104, 107, 109, 102, 161,  76,   3,  91, 191, 147, 169, 182, 194, 225, 120};
+static const unsigned char GP_17[] = { 43, 139, 206,  78,  43, 239, 123, 206, 214, 147,  24,  99, 150,  39, 243, 163, 136};
+static const unsigned char GP_18[] = {215, 234, 158,  94, 184,  97, 118, 170,  79, 187, 152, 148, 252, 179,   5,  98,  96, 153};
+static const unsigned char GP_20[] = { 17,  60,  79,  50,  61, 163,  26, 187, 202, 180, 221, 225,  83, 239, 156, 164, 212, 212, 188, 190};
+static const unsigned char GP_22[] = {210, 171, 247, 242,  93, 230,  14, 109, 221,  53, 200,  74,   8, 172,  98,  80, 219, 134, 160, 105, 165, 231};
+static const unsigned char GP_24[] = {229, 121, 135,  48, 211, 117, 251, 126, 159, 180, 169, 152, 192, 226, 228, 218, 111,   0, 117, 232,  87,  96, 227,  21};
+static const unsigned char GP_26[] = {173, 125, 158,   2, 103, 182, 118,  17, 145, 201, 111,  28, 165,  53, 161,  21, 245, 142,  13, 102,  48, 227, 153, 145, 218,  70};
+static const unsigned char GP_28[] = {168, 223, 200, 104, 224, 234, 108, 180, 110, 190, 195, 147, 205,  27, 232, 201,  21,  43, 245,  87,  42, 195, 212, 119, 242,  37,   9, 123};
+static const unsigned char GP_30[] = { 41, 173, 145, 152, 216,  31, 179, 182,  50,  48, 110,  86, 239,  96, 222, 125,  42, 173, 226, 193, 224, 130, 156,  37, 251, 216, 238,  40, 192, 180};
+
+static const unsigned char *GP_LIST[] =
+{
+     NULL,  NULL,  NULL,  NULL,  NULL,  NULL,  NULL,  GP_7,  NULL,  NULL,
+    GP_10,  NULL,  NULL, GP_13,  NULL, GP_15, GP_16, GP_17, GP_18,  NULL,
+    GP_20,  NULL, GP_22,  NULL, GP_24,  NULL, GP_26,  NULL, GP_28,  NULL,
+    GP_30
+};
+
+/* Tables derived from GF_INT, GF_EXP and GP_LIST */
+class GF_TABLES
+{
+public:
+    /* exp[X] = α^X for X < 510, a sum of two exponents needs no modulo */
+    unsigned char exp[512];
+    /* Generator polynomial coefficients (values, not exponents), zero padded to 32 bytes */
+    alignas(16) unsigned char generator[RS_MAX_EC_BYTES + 1][32];
+    /* Split nibble products: mul_lo[c][n] = c*n; mul_hi[c][n] = c*(n << 4) */
+    alignas(16) unsigned char mul_lo[256][16];
+    alignas(16) unsigned char mul_hi[256][16];
+
+    GF_TABLES();
+
+    unsigned char mul(int a, int b) const
+    {
+        return (a && b) ? exp[GF_EXP[a] + GF_EXP[b]] : 0;
+    }
+};
+
+GF_TABLES::GF_TABLES()
+{
+    for (int i = 0; i < 512; i++)
+    {
+        exp[i] = GF_INT[i % 255];
+    }
+
+    memset(generator, 0, sizeof(generator));
+    for (int n = 0; n <= RS_MAX_EC_BYTES; n++)
+    {
+        for (int j = 0; GP_LIST[n] && j < n; j++)
+        {
+            generator[n][j] = GF_INT[GP_LIST[n][j]];
+        }
+    }
+
+    for (int c = 0; c < 256; c++)
+    {
+        for (int n = 0; n < 16; n++)
+        {
+            mul_lo[c][n] = mul(c, n);
+            mul_hi[c][n] = mul(c, n << 4);
+        }
+    }
+}
+
+static const GF_TABLES &gf_tables()
+{
+    static const GF_TABLES tables;
+    return tables;
+}
+
+/* Division by the generator polynomial as a linear feedback shift register
+ * The remainder is a ring buffer starting at head: shifting it by one codeword only moves head */
+void rs_encode_scalar(const unsigned char *data, int data_bytes, unsigned char *ec, int ec_bytes)
+{
+    const GF_TABLES &gf = gf_tables();
+    const unsigned char *g = GP_LIST[ec_bytes];
+    unsigned char rem[RS_MAX_EC_BYTES] = {0};
+    int head = 0;
+
+    for (int i = 0; i < data_bytes; i++)
+    {
+        unsigned char feedback = data[i] ^ rem[head];
+
+        /* Drop the leading remainder codeword, its slot becomes the last one */
+        rem[head] = 0;
+        head = (head + 1 == ec_bytes) ? 0 : head + 1;
+
+        if (feedback)
+        {
+            /* exp[GF_EXP[feedback] + g[j]] = feedback * α^g[j] */
+            const unsigned char *exp = gf.exp + GF_EXP[feedback];
+            int n = ec_bytes - head;
+
+            for (int j = 0; j < n; j++)
+            {
+                rem[head + j] ^= exp[g[j]];
+            }
+
+            for (int j = 0; j < head; j++)
+            {
+                rem[j] ^= exp[g[n + j]];
+            }
+        }
+    }
+
+    memcpy(ec, rem + head, ec_bytes - head);
+    memcpy(ec + ec_bytes - head, rem, head);
+}
+
+#if defined(QR_X86_SIMD)
+/* The remainder lives in two 16-byte registers, every step multiplies all generator
+ * coefficients by the feedback codeword with two PSHUFB nibble lookups */
+QR_TARGET("ssse3")
+static void rs_encode_ssse3(const unsigned char *data, int data_bytes, unsigned char *ec, int ec_bytes)
+{
+    const GF_TABLES &gf = gf_tables();
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+
+    __m128i g0 = _mm_load_si128((const __m128i *)&gf.generator[ec_bytes][0]);
+    __m128i g1 = _mm_load_si128((const __m128i *)&gf.generator[ec_bytes][16]);
+    __m128i g0_lo = _mm_and_si128(g0, nibble);
+    __m128i g0_hi = _mm_and_si128(_mm_srli_epi16(g0, 4), nibble);
+    __m128i g1_lo = _mm_and_si128(g1, nibble);
+    __m128i g1_hi = _mm_and_si128(_mm_srli_epi16(g1, 4), nibble);
+
+    __m128i r0 = _mm_setzero_si128();
+    __m128i r1 = _mm_setzero_si128();
+
+    for (int i = 0; i < data_bytes; i++)
+    {
+        unsigned char feedback = data[i] ^ (unsigned char)_mm_cvtsi128_si32(r0);
+        __m128i lo = _mm_load_si128((const __m128i *)gf.mul_lo[feedback]);
+        __m128i hi = _mm_load_si128((const __m128i *)gf.mul_hi[feedback]);
+
+        /* Shift the remainder by one codeword */
+        r0 = _mm_alignr_epi8(r1, r0, 1);
+        r1 = _mm_srli_si128(r1, 1);
+
+        r0 = _mm_xor_si128(r0, _mm_xor_si128(_mm_shuffle_epi8(lo, g0_lo), _mm_shuffle_epi8(hi, g0_hi)));
+        r1 = _mm_xor_si128(r1, _mm_xor_si128(_mm_shuffle_epi8(lo, g1_lo), _mm_shuffle_epi8(hi, g1_hi)));
+    }
+
+    unsigned char rem[32];
+    _mm_storeu_si128((__m128i *)&rem[0], r0);
+    _mm_storeu_si128((__m128i *)&rem[16], r1);
+    memcpy(ec, rem, ec_bytes);
+}
+
+/* c*v for each byte of v, given the low and high nibbles of v */
+QR_TARGET("ssse3")
+static inline __m128i gf_mul_lanes(const GF_TABLES &gf, int c, __m128i v_lo, __m128i v_hi)
+{
+    __m128i lo = _mm_shuffle_epi8(_mm_load_si128((const __m128i *)gf.mul_lo[c]), v_lo);
+    __m128i hi = _mm_shuffle_epi8(_mm_load_si128((const __m128i *)gf.mul_hi[c]), v_hi);
+
+    return _mm_xor_si128(lo, hi);
+}
+
+/* Up to 16 messages, one per byte lane: the ring buffer LFSR of rs_encode_scalar
+ * with each remainder codeword held as a vector of 16 messages */
+QR_TARGET("ssse3")
+static void rs_encode_lanes_ssse3(const unsigned char *const *data, unsigned char *const *ec, int lanes, int data_bytes, int ec_bytes)
+{
+    const GF_TABLES &gf = gf_tables();
+    const unsigned char *g = gf.generator[ec_bytes];
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    __m128i rem[RS_MAX_EC_BYTES];
+    alignas(16) unsigned char column[RS_LANES] = {0};
+    int head = 0;
+
+    for (int j = 0; j < ec_bytes; j++)
+    {
+        rem[j] = _mm_setzero_si128();
+    }
+
+    for (int i = 0; i < data_bytes; i++)
+    {
+        /* Codeword i of every message */
+        for (int l = 0; l < lanes; l++)
+        {
+            column[l] = data[l][i];
+        }
+
+        __m128i feedback = _mm_xor_si128(_mm_load_si128((const __m128i *)column), rem[head]);
+        __m128i feedback_lo = _mm_and_si128(feedback, nibble);
+        __m128i feedback_hi = _mm_and_si128(_mm_srli_epi16(feedback, 4), nibble);
+
+        rem[head] = _mm_setzero_si128();
+        head = (head + 1 == ec_bytes) ? 0 : head + 1;
+
+        int n = ec_bytes - head;
+
+        for (int j = 0; j < n; j++)
+        {
+            rem[head + j] = _mm_xor_si128(rem[head + j], gf_mul_lanes(gf, g[j], feedback_lo, feedback_hi));
+        }
+
+        for (int j = 0; j < head; j++)
+        {
+            rem[j] = _mm_xor_si128(rem[j], gf_mul_lanes(gf, g[n + j], feedback_lo, feedback_hi));
+        }
+    }
+
+    for (int j = 0; j < ec_bytes; j++)
+    {
+        _mm_store_si128((__m128i *)column, rem[(head + j < ec_bytes) ? head + j : head + j - ec_bytes]);
+
+        for (int l = 0; l < lanes; l++)
+        {
+            ec[l][j] = column[l];
+        }
+    }
+}
+#endif
+
+void rs_encode_batch(const unsigned char *const *data, unsigned char *const *ec, int count, int data_bytes, int ec_bytes)
+{
+#if defined(QR_X86_SIMD)
+    if (cpu_has_ssse3())
+    {
+        for (int i = 0; i < count; i += RS_LANES)
+        {
+            int lanes = (count - i < RS_LANES) ? (count - i) : RS_LANES;
+            rs_encode_lanes_ssse3(data + i, ec + i, lanes, data_bytes, ec_bytes);
+        }
+        return;
+    }
+#endif
+
+    for (int i = 0; i < count; i++)
+    {
+        rs_encode_scalar(data[i], data_bytes, ec[i], ec_bytes);
+    }
+}
+
+void rs_encode(const unsigned char *data, int data_bytes, unsigned char *ec, int ec_bytes)
+{
+#if defined(QR_X86_SIMD)
+    if (cpu_has_ssse3())
+    {
+        rs_encode_ssse3(data, data_bytes, ec, ec_bytes);
+        return;
+    }
+#endif
+
+    rs_encode_scalar(data, data_bytes, ec, ec_bytes);
+}
+
+RS_TEMPLATE::RS_TEMPLATE(const unsigned char *reference, int data_bytes, int ec_bytes)
+    : data_bytes(data_bytes), ec_bytes(ec_bytes), reference(reference, reference + data_bytes), unit(data_bytes*32, 0)
+{
+    const GF_TABLES &gf = gf_tables();
+    const unsigned char *g = gf.generator[ec_bytes];
+    unsigned char rem[RS_MAX_EC_BYTES + 1] = {0};
+
+    rs_encode(reference, data_bytes, parity, ec_bytes);
+
+    /* A unit codeword at the last position leaves the generator polynomial as remainder,
+     * every position before it is one more LFSR step with zero input */
+    for (int i = data_bytes - 1; i >= 0; i--)
+    {
+        unsigned char feedback = (i == data_bytes - 1) ? 1 : rem[0];
+
+        memmove(rem, rem + 1, ec_bytes);
+        for (int j = 0; j < ec_bytes; j++)
+        {
+            rem[j] ^= gf.mul(feedback, g[j]);
+        }
+
+        memcpy(&unit[i*32], rem, ec_bytes);
+    }
+}
+
+/* acc ^= delta*unit for each differing codeword, the unit parity is always 32 bytes */
+static void rs_template_scalar(const GF_TABLES &gf, const unsigned char *data, const unsigned char *reference, int data_bytes, const unsigned char *unit, unsigned char *acc, int ec_bytes)
+{
+    for (int i = 0; i < data_bytes; i++)
+    {
+        unsigned char delta = data[i] ^ reference[i];
+
+        if (delta)
+        {
+            const unsigned char *lo = gf.mul_lo[delta];
+            const unsigned char *hi = gf.mul_hi[delta];
+            const unsigned char *u = unit + i*32;
+
+            for (int j = 0; j < ec_bytes; j++)
+            {
+                acc[j] ^= lo[u[j] & 0x0F] ^ hi[u[j] >> 4];
+            }
+        }
+    }
+}
+
+#if defined(QR_X86_SIMD)
+QR_TARGET("ssse3")
+static void rs_template_ssse3(const GF_TABLES &gf, const unsigned char *data, const unsigned char *reference, int data_bytes, const unsigned char *unit, unsigned char *acc)
+{
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    __m128i a0 = _mm_loadu_si128((const __m128i *)&acc[0]);
+    __m128i a1 = _mm_loadu_si128((const __m128i *)&acc[16]);
+
+    for (int i = 0; i < data_bytes; i++)
+    {
+        unsigned char delta = data[i] ^ reference[i];
+
+        if (delta)
+        {
+            __m128i lo = _mm_load_si128((const __m128i *)gf.mul_lo[delta]);
+            __m128i hi = _mm_load_si128((const __m128i *)gf.mul_hi[delta]);
+            __m128i u0 = _mm_loadu_si128((const __m128i *)&unit[i*32]);
+            __m128i u1 = _mm_loadu_si128((const __m128i *)&unit[i*32 + 16]);
+
+            a0 = _mm_xor_si128(a0, _mm_xor_si128(_mm_shuffle_epi8(lo, _mm_and_si128(u0, nibble)),
+                                                 _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi16(u0, 4), nibble))));
+            a1 = _mm_xor_si128(a1, _mm_xor_si128(_mm_shuffle_epi8(lo, _mm_and_si128(u1, nibble)),
+                                                 _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi16(u1, 4), nibble))));
+        }
+    }
+
+    _mm_storeu_si128((__m128i *)&acc[0], a0);
+    _mm_storeu_si128((__m128i *)&acc[16], a1);
+}
+#endif
+
+void RS_TEMPLATE::encode(const unsigned char *data, unsigned char *ec) const
+{
+    int differ = 0;
+
+    for (int i = 0; i < data_bytes; i++)
+    {
+        differ += (data[i] != reference[i]);
+    }
+
+    if (differ*2 > data_bytes)
+    {
+        rs_encode(data, data_bytes, ec, ec_bytes);
+        return;
+    }
+
+    const GF_TABLES &gf = gf_tables();
+    unsigned char acc[32] = {0};
+
+    memcpy(acc, parity, ec_bytes);
+
+#if defined(QR_X86_SIMD)
+    if (cpu_has_ssse3())
+    {
+        rs_template_ssse3(gf, data, &reference[0], data_bytes, &unit[0], acc);
+        memcpy(ec, acc, ec_bytes);
+        return;
+    }
+#endif
+
+    rs_template_scalar(gf, data, &reference[0], data_bytes, &unit[0], acc, ec_bytes);
+    memcpy(ec, acc, ec_bytes);
+}
@@ -0,0 +1,43 @@
+#ifndef _RS_H_
+#define _RS_H_
+
+#include <vector>
+
+/* Max error correction codewords per block */
+#define RS_MAX_EC_BYTES          (30)
+
+/* Reed-Solomon: calculate ec_bytes error correction codewords of data_bytes data codewords into ec
+ * Uses the SSSE3 kernel when the CPU supports it, the table-driven scalar encoder otherwise. */
+void rs_encode(const unsigned char *data, int data_bytes, unsigned char *ec, int ec_bytes);
+
+/* Messages encoded in lock-step by rs_encode_batch */
+#define RS_LANES                 (16)
+
+/* Reed-Solomon of count messages with the same block size: message i is data[i], its codewords go to ec[i]
+ * Groups of RS_LANES messages are transposed into SIMD lanes and encoded together. */
+void rs_encode_batch(const unsigned char *const *data, unsigned char *const *ec, int count, int data_bytes, int ec_bytes);
+
+/* Reed-Solomon codes are linear: parity(data) = parity(reference) ^ sum of (data[i] ^ reference[i])*parity(unit codeword at i)
+ * For messages that differ from a reference in a few codewords (fixed prefix and padding) only those codewords cost work. */
+class RS_TEMPLATE
+{
+public:
+    RS_TEMPLATE(const unsigned char *reference, int data_bytes, int ec_bytes);
+
+    /* Same result as rs_encode(data, data_bytes, ec, ec_bytes)
+     * Falls back to rs_encode when more than half of the codewords differ from the reference. */
+    void encode(const unsigned char *data, unsigned char *ec) const;
+
+private:
+    int data_bytes;
+    int ec_bytes;
+    std::vector<unsigned char> reference;
+    unsigned char parity[RS_MAX_EC_BYTES];
+    /* Parity of a unit codeword at each position, 32 bytes per position */
+    std::vector<unsigned char> unit;
+};
+
+/* Scalar encoder only */
+void rs_encode_scalar(const unsigned char *data, int data_bytes, unsigned char *ec, int ec_bytes);
+
+#endif /* _RS_H_ */
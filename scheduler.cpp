@@ -0,0 +1,264 @@
+#include "scheduler.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+using namespace std;
+
+/* Indices [begin, end) not yet taken, owned by one worker */
+class WORK_RANGE
+{
+public:
+    mutex lock;
+    int begin;
+    int end;
+
+    WORK_RANGE() : begin(0), end(0) {}
+};
+
+/* One parallel_for call: the calling thread is worker 0, pool threads join as workers 1 ~ ranges.size() - 1 */
+class JOB
+{
+public:
+    vector<WORK_RANGE> ranges;
+    const function<void(int)> *task;
+    /* Next worker id to hand out */
+    int joined;
+    /* Tasks not finished yet */
+    atomic<int> remaining;
+    mutex lock;
+    condition_variable done;
+
+    JOB(int workers, int count, const function<void(int)> &task) : ranges(workers), task(&task), joined(1), remaining(count) {}
+};
+
+/* Take the next index of own range */
+static bool pop(WORK_RANGE &range, int &index)
+{
+    lock_guard<mutex> guard(range.lock);
+
+    if (range.begin < range.end)
+    {
+        index = range.begin++;
+        return true;
+    }
+
+    return false;
+}
+
+/* Move the upper half of another worker's range into own range */
+static bool steal(vector<WORK_RANGE> &ranges, int id)
+{
+    int workers = ranges.size();
+
+    for (int i = 1; i < workers; i++)
+    {
+        WORK_RANGE &victim = ranges[(id + i) % workers];
+        int begin, end;
+
+        {
+            lock_guard<mutex> guard(victim.lock);
+
+            if (victim.begin >= victim.end)
+            {
+                continue;
+            }
+
+            begin = victim.begin + (victim.end - victim.begin)/2;
+            end = victim.end;
+            victim.end = begin;
+        }
+
+        lock_guard<mutex> guard(ranges[id].lock);
+        ranges[id].begin = begin;
+        ranges[id].end = end;
+
+        return true;
+    }
+
+    return false;
+}
+
+static void worker(JOB &job, int id)
+{
+    int index;
+
+    for (;;)
+    {
+        if (pop(job.ranges[id], index))
+        {
+            (*job.task)(index);
+
+            if (1 == job.remaining.fetch_sub(1))
+            {
+                lock_guard<mutex> guard(job.lock);
+                job.done.notify_all();
+            }
+        }
+        else if (!steal(job.ranges, id))
+        {
+            break;
+        }
+    }
+}
+
+/* Threads started once and reused by every parallel_for call
+ * A caller never waits for a pool thread to become free: it works through its own job, and steals the ranges
+ * no pool thread has joined, so nested calls (eg: from a task) and a pool with fewer threads still finish. */
+class THREAD_POOL
+{
+private:
+    mutex lock;
+    condition_variable wake;
+    /* Jobs with worker ids left to hand out */
+    deque<shared_ptr<JOB> > jobs;
+    vector<thread> threads;
+    bool stop;
+
+    void run()
+    {
+        for (;;)
+        {
+            shared_ptr<JOB> job;
+            int id;
+
+            {
+                unique_lock<mutex> guard(lock);
+                wake.wait(guard, [this] { return stop || !jobs.empty(); });
+
+                if (stop)
+                {
+                    return;
+                }
+
+                job = jobs.front();
+                id = job->joined++;
+
+                if (job->joined == (int)job->ranges.size())
+                {
+                    jobs.pop_front();
+                }
+            }
+
+            worker(*job, id);
+        }
+    }
+
+public:
+    THREAD_POOL() : stop(false)
+    {
+        int count = thread::hardware_concurrency();
+
+        /* The calling thread is a worker too */
+        try
+        {
+            /* push_back never throws with a started thread in hand */
+            threads.reserve(count);
+
+            for (int i = 1; i < count; i++)
+            {
+                threads.push_back(thread(&THREAD_POOL::run, this));
+            }
+        }
+        catch (...)
+        {
+            /* Run with the threads that did start */
+        }
+    }
+
+    ~THREAD_POOL()
+    {
+        {
+            lock_guard<mutex> guard(lock);
+            stop = true;
+        }
+        wake.notify_all();
+
+        for (unsigned int i = 0; i < threads.size(); i++)
+        {
+            threads[i].join();
+        }
+    }
+
+    /* Most workers of a job: pool threads + the calling thread */
+    int size() const
+    {
+        return threads.size() + 1;
+    }
+
+    void post(const shared_ptr<JOB> &job)
+    {
+        {
+            lock_guard<mutex> guard(lock);
+            jobs.push_back(job);
+        }
+
+        for (unsigned int i = 1; i < job->ranges.size(); i++)
+        {
+            wake.notify_one();
+        }
+    }
+
+    /* Hand out no more worker ids of a finished job */
+    void remove(const shared_ptr<JOB> &job)
+    {
+        lock_guard<mutex> guard(lock);
+
+        for (deque<shared_ptr<JOB> >::iterator it = jobs.begin(); it != jobs.end(); ++it)
+        {
+            if (*it == job)
+            {
+                jobs.erase(it);
+                break;
+            }
+        }
+    }
+};
+
+static THREAD_POOL &thread_pool()
+{
+    static THREAD_POOL pool;
+    return pool;
+}
+
+void parallel_for(int count, int threads, const function<void(int)> &task)
+{
+    /* The pool is only started by the first call that can use it */
+    if (1 != threads && count > 1)
+    {
+        int workers = thread_pool().size();
+
+        threads = (threads <= 0 || threads > workers) ? workers : threads;
+        threads = (threads > count) ? count : threads;
+    }
+
+    if (threads <= 1 || count <= 1)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            task(i);
+        }
+
+        return;
+    }
+
+    shared_ptr<JOB> job = make_shared<JOB>(threads, count, task);
+
+    for (int i = 0; i < threads; i++)
+    {
+        job->ranges[i].begin = (long long)count*i/threads;
+        job->ranges[i].end = (long long)count*(i + 1)/threads;
+    }
+
+    thread_pool().post(job);
+    worker(*job, 0);
+
+    /* Every range is taken, wait for the tasks still running on pool threads */
+    thread_pool().remove(job);
+
+    unique_lock<mutex> guard(job->lock);
+    job->done.wait(guard, [&job] { return 0 == job->remaining.load(); });
+}
@@ -0,0 +1,19 @@
+#ifndef _SCHEDULER_H_
+#define _SCHEDULER_H_
+
+#include <functional>
+
+/* Run task(0) ... task(count - 1) on up to threads workers (0: one per hardware thread)
+ * and return when all of them are done.
+ * Workers are the calling thread and the threads of a pool started on first use and kept for the life of the process,
+ * at most one per hardware thread. Each worker starts with a contiguous range of indices, a worker that runs out of work
+ * steals the upper half of the range of another worker, so uneven task costs keep every worker busy.
+ * Calls may be nested (eg: from a task) and made from several threads at once.
+ * task must not throw. */
+void parallel_for(int count, int threads, const std::function<void(int)> &task);
+
+/* Caller-supplied executor: run task(0) ... task(count - 1), possibly concurrently,
+ * and return when all of them are done, eg: a wrapper of parallel_for or of an existing thread pool */
+typedef std::function<void(int count, const std::function<void(int)> &task)> EXECUTOR;
+
+#endif /* _SCHEDULER_H_ */
@@ -0,0 +1,64 @@
+#ifndef _SIMD_H_
+#define _SIMD_H_
+
+/* x86 SIMD kernels are compiled with per-function target attributes (GCC, Clang)
+ * or plain intrinsics (MSVC), and only called after a runtime CPU check. */
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define QR_X86_SIMD 1
+#define QR_TARGET(isa) __attribute__((target(isa)))
+#include <immintrin.h>
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define QR_X86_SIMD 1
+#define QR_TARGET(isa)
+#include <intrin.h>
+#endif
+
+#if defined(QR_X86_SIMD)
+
+#if defined(_MSC_VER)
+static inline void cpuid(int leaf, int info[4])
+{
+    __cpuidex(info, leaf, 0);
+}
+#else
+#include <cpuid.h>
+static inline void cpuid(int leaf, int info[4])
+{
+    unsigned int a = 0, b = 0, c = 0, d = 0;
+    __cpuid_count(leaf, 0, a, b, c, d);
+    info[0] = a;
+    info[1] = b;
+    info[2] = c;
+    info[3] = d;
+}
+#endif
+
+/* CPUID leaf 1, ECX bit 9 */
+static inline bool cpu_has_ssse3()
+{
+    static const bool supported = []()
+    {
+        int info[4];
+        cpuid(1, info);
+        return ((info[2] >> 9) & 0x01) != 0;
+    }();
+
+    return supported;
+}
+
+/* CPUID leaf 1, ECX bit 1 */
+static inline bool cpu_has_pclmul()
+{
+    static const bool supported = []()
+    {
+        int info[4];
+        cpuid(1, info);
+        return ((info[2] >> 1) & 0x01) != 0;
+    }();
+
+    return supported;
+}
+
+#endif /* QR_X86_SIMD */
+
+#endif /* _SIMD_H_ */
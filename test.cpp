@@ -1,5 +1,14 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include "QR.h"
+#include "penalty.h"
+#include "png/png.h"
+#include "png/filter.h"
+#include "png/util.h"
+
+static int failures = 0;
+
+#define CHECK(cond, ...)  do { if (!(cond)) { failures++; printf("FAIL %s:%d: ", __FILE__, __LINE__); printf(__VA_ARGS__); printf("\n"); } } while (0)
 
 static char error_correction_char(int ec_level)
 {
@@ -43,8 +52,688 @@ void test_chinese(int v, int e)
     QR qr = QR("测试QR", path, e, v);
 }
 
+/* Module by module, as the rules read (ISO/IEC 18004 8.8.2), modules out of the symbol are light */
+static int penalty_reference(const BIT_MATRIX &matrix)
+{
+    int size = matrix.size;
+    int score = 0;
+    int dark = 0;
+
+    for (int pass = 0; pass < 2; pass++)
+    {
+        /* pass 0: rows, pass 1: columns */
+        for (int i = 0; i < size; i++)
+        {
+            int run = 1;
+
+            for (int j = 0; j < size; j++)
+            {
+                bool module = pass ? matrix.get(j, i) : matrix.get(i, j);
+                bool next = (j + 1 < size) && (pass ? matrix.get(j + 1, i) : matrix.get(i, j + 1)) == module;
+
+                /* N1: 3 + (n - 5) for each run of n >= 5 same color modules */
+                if (next)
+                {
+                    run++;
+                    continue;
+                }
+
+                if (run >= 5)
+                {
+                    score += 3 + (run - 5);
+                }
+                run = 1;
+            }
+
+            /* N3: 1:1:3:1:1 with 4 light modules on either side */
+            for (int j = 0; j + 6 < size; j++)
+            {
+                const int pattern[] = {1, 0, 1, 1, 1, 0, 1};
+                bool found = true;
+                bool before = true;
+                bool after = true;
+
+                for (int k = 0; k < 7; k++)
+                {
+                    found = found && (pass ? matrix.get(j + k, i) : matrix.get(i, j + k)) == (1 == pattern[k]);
+                }
+
+                for (int k = 1; k <= 4; k++)
+                {
+                    before = before && (j - k < 0 || !(pass ? matrix.get(j - k, i) : matrix.get(i, j - k)));
+                    after = after && (j + 6 + k >= size || !(pass ? matrix.get(j + 6 + k, i) : matrix.get(i, j + 6 + k)));
+                }
+
+                if (found && (before || after))
+                {
+                    score += 40;
+                }
+            }
+        }
+    }
+
+    for (int x = 0; x < size; x++)
+    {
+        for (int y = 0; y < size; y++)
+        {
+            /* N2: 3 for each 2*2 block of the same color */
+            if (x + 1 < size && y + 1 < size && matrix.get(x, y) == matrix.get(x, y + 1)
+                && matrix.get(x, y) == matrix.get(x + 1, y) && matrix.get(x, y) == matrix.get(x + 1, y + 1))
+            {
+                score += 3;
+            }
+
+            dark += matrix.get(x, y);
+        }
+    }
+
+    /* N4: 10 for each 5% of deviation from 50% dark */
+    score += 10*(abs(50 - dark*100/(size*size))/5);
+
+    return score;
+}
+
+/* The bit-parallel penalty engine scores the same as the reference
+ * on random matrices of several versions, from mostly light to mostly dark, with long runs and finder-like patterns */
+void check_penalty()
+{
+    const int versions[] = {1, 2, 6, 7, 14, 15, 27, 40};
+
+    srand(5);
+
+    for (int v = 0; v < (int)(sizeof(versions)/sizeof(versions[0])); v++)
+    {
+        int size = 17 + 4*versions[v];
+
+        for (int n = 0; n < 24; n++)
+        {
+            BIT_MATRIX matrix(size);
+            int dark = 5 + n*90/23;
+
+            for (int x = 0; x < size; x++)
+            {
+                for (int y = 0; y < size; y++)
+                {
+                    /* Odd n: runs of the previous module, to make N1 and N2 likely */
+                    bool repeat = (n & 1) && y > 0 && rand() % 4;
+                    matrix.set(x, y, repeat ? matrix.get(x, y - 1) : rand() % 100 < dark);
+                }
+            }
+
+            /* 1011101 with light modules around it, in rows and columns, at the edges too */
+            for (int k = 0; k < 4; k++)
+            {
+                const int pattern[] = {0, 0, 0, 0, 1, 0, 1, 1, 1, 0, 1, 0, 0, 0, 0};
+                int x = rand() % size;
+                int y = (k < 2) ? (k ? size - 11 : -4) : rand() % (size - 14);
+
+                for (int j = 0; j < 15; j++)
+                {
+                    if (y + j >= 0 && y + j < size)
+                    {
+                        if (k & 1)
+                        {
+                            matrix.set(y + j, x, 1 == pattern[j]);
+                        }
+                        else
+                        {
+                            matrix.set(x, y + j, 1 == pattern[j]);
+                        }
+                    }
+                }
+            }
+
+            int expected = penalty_reference(matrix);
+            int score = penalty_score(matrix);
+
+            CHECK(expected == score, "penalty version %d matrix %d: %d, reference %d", versions[v], n, score, expected);
+
+            /* With a limit above the score, scoring runs to the end */
+            std::atomic<int> limit(expected);
+            CHECK(expected == penalty_score(matrix, &limit), "penalty version %d matrix %d with limit", versions[v], n);
+        }
+    }
+}
+
+/* Every index runs exactly once, with nested calls and calls from several threads at once */
+void check_parallel_for()
+{
+    const int count = 1000;
+    vector<std::atomic<int> > runs(count*8);
+
+    for (int i = 0; i < count*8; i++)
+    {
+        runs[i] = 0;
+    }
+
+    parallel_for(8, 0, [&](int outer)
+    {
+        parallel_for(count, (outer % 3) ? 0 : 2, [&](int i)
+        {
+            runs[outer*count + i]++;
+        });
+    });
+
+    for (int i = 0; i < count*8; i++)
+    {
+        CHECK(1 == runs[i], "parallel_for index %d ran %d times", i, (int)runs[i]);
+    }
+}
+
+static bool same_symbol(const QR_SYMBOL &a, const QR_SYMBOL &b)
+{
+    if (a.error != b.error || a.version != b.version || a.size != b.size || a.ec_level != b.ec_level || a.mask != b.mask)
+    {
+        return false;
+    }
+
+    for (int x = 0; x < a.size; x++)
+    {
+        for (int y = 0; y < a.size; y++)
+        {
+            if (a.module(x, y) != b.module(x, y))
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+static void check_batch_options(const vector<string> &payloads, const QR_OPTIONS &options)
+{
+    vector<QR_SYMBOL> symbols = QR::encode_batch(payloads, options);
+
+    CHECK(symbols.size() == payloads.size(), "batch size %d", (int)symbols.size());
+
+    for (size_t i = 0; i < symbols.size() && i < payloads.size(); i++)
+    {
+        CHECK(same_symbol(symbols[i], QR::encode(payloads[i], options)), "batch payload %d level %d threads %d batch_ec %d ec_template %d mixed_mode %d",
+              (int)i, options.ec_level, options.threads, options.batch_ec, !options.ec_template.empty(), options.mixed_mode);
+    }
+}
+
+/* Parallel and early-exit mask scoring pick the same mask as scoring every candidate in turn */
+void check_mask_threads()
+{
+    for (int v = 1; v <= 40; v++)
+    {
+        QR_OPTIONS serial;
+        QR_OPTIONS parallel;
+
+        serial.version = parallel.version = v;
+        serial.mask_early_exit = false;
+        parallel.mask_threads = 0;
+
+        CHECK(same_symbol(QR::encode("MASK THREADS 0123456789", serial), QR::encode("MASK THREADS 0123456789", parallel)),
+              "mask threads version %d", v);
+    }
+}
+
+/* encode_batch returns what encode does for each payload, in input order, however the parity is computed */
+void check_batch()
+{
+    vector<string> payloads;
+    char buff[64] = {0};
+
+    for (int i = 0; i < 200; i++)
+    {
+        sprintf(buff, "https://example.com/item?id=%06d", i*7919);
+        payloads.push_back(buff);
+        payloads.push_back(string(buff + 28));
+        payloads.push_back(string(i % 40 + 1, 'A' + i % 26));
+    }
+    /* Errors: empty and too long */
+    payloads.push_back("");
+    payloads.push_back(string(8000, '7'));
+
+    for (int e = LEVEL_L; e <= LEVEL_H; e++)
+    {
+        for (int threads = 0; threads <= 3; threads++)
+        {
+            QR_OPTIONS options;
+
+            options.ec_level = e;
+            options.threads = threads;
+
+            check_batch_options(payloads, options);
+
+            /* Parity of payloads with the same version and level in lock-step */
+            options.batch_ec = true;
+            check_batch_options(payloads, options);
+
+            /* Parity from a reference sharing the URL prefix, the short payloads do not fit its versions */
+            options.ec_template = "https://example.com/item?id=000000";
+            check_batch_options(payloads, options);
+
+            options.batch_ec = false;
+            check_batch_options(payloads, options);
+
+            /* Segments, the reference is split the same way */
+            options.mixed_mode = true;
+            check_batch_options(payloads, options);
+
+            options.batch_ec = true;
+            check_batch_options(payloads, options);
+        }
+    }
+}
+
+/* Segments never take more bits than one mode for the whole content: never a larger version */
+void check_mixed_mode()
+{
+    const char *contents[] = {"0123456789ABCDEF", "HELLO WORLD 0123456789012345 hello", "abc123456789012def",
+                              "\x83\x65\x83\x58" "ABC0123456789", "1234567890123456789012345678901234567890ABCDEFGHIJKLMNOPQRSTUVWXYZabc",
+                              "A1b2C3d4", "0000000000000000000000000000000000000000x"};
+
+    for (int c = 0; c < (int)(sizeof(contents)/sizeof(contents[0])); c++)
+    {
+        for (int e = LEVEL_L; e <= LEVEL_H; e++)
+        {
+            for (int repeat = 1; repeat <= 64; repeat *= 2)
+            {
+                string content;
+                QR_OPTIONS single;
+                QR_OPTIONS mixed;
+                int single_version = 0;
+                int mixed_version = 0;
+
+                for (int i = 0; i < repeat; i++)
+                {
+                    content += contents[c];
+                }
+
+                single.ec_level = mixed.ec_level = e;
+                mixed.mixed_mode = true;
+
+                int single_error = QR::fit(content, single, &single_version);
+                int mixed_error = QR::fit(content, mixed, &mixed_version);
+
+                CHECK(QR_OK != single_error || (QR_OK == mixed_error && mixed_version <= single_version),
+                      "mixed mode content %d x%d level %d: version %d > %d", c, repeat, e, mixed_version, single_version);
+
+                /* Same version: whatever fits in one mode fits in segments */
+                for (int v = 1; QR_OK == single_error && v <= 40; v++)
+                {
+                    single.version = mixed.version = v;
+
+                    if (QR_OK == QR::fit(content, single))
+                    {
+                        CHECK(QR_OK == QR::fit(content, mixed), "mixed mode content %d x%d level %d version %d", c, repeat, e, v);
+                    }
+                }
+            }
+        }
+    }
+}
+
+/* Content of exactly QR::capacity characters fits the version, one more does not */
+void check_capacity()
+{
+    const char *units[] = {"1", "A", "a", "\x83\x65"};
+
+    for (int mode = NUMERIC; mode <= KANJI; mode++)
+    {
+        for (int e = LEVEL_L; e <= LEVEL_H; e++)
+        {
+            for (int v = 1; v <= 40; v++)
+            {
+                int chars = QR::capacity(v, e, mode);
+                string content;
+                QR_OPTIONS options;
+
+                for (int i = 0; i < chars; i++)
+                {
+                    content += units[mode];
+                }
+
+                options.ec_level = e;
+                options.version = v;
+
+                CHECK(QR_OK == QR::fit(content, options), "capacity mode %d level %d version %d: %d fit", mode, e, v, chars);
+                CHECK(QR_OK != QR::fit(content + units[mode], options), "capacity mode %d level %d version %d: %d + 1 fit", mode, e, v, chars);
+            }
+        }
+    }
+
+    /* UTF-8 content reserves the 12 bits of the ECI header in every mode:
+     * 20 bytes read as 10 Shift JIS characters fill version 1-L (140 bits) without it, not with it */
+    string utf8 = "\xE6\x81\x81\xE6\x81\x81\xE6\x81\x81\xE6\x81\x81\xE6\x81\x81\xC2\x81\xE6\x81\x81";
+    string shift_jis = "\x83\x65\x83\x65\x83\x65\x83\x65\x83\x65\x83\x65\x83\x65\x83\x65\x83\x65\x83\x65";
+    QR_SYMBOL symbol = QR::encode(utf8, LEVEL_L);
+
+    CHECK(2 == symbol.version && KANJI == symbol.mode && UTF_8 == symbol.encoding, "UTF-8 kanji version %d mode %d", symbol.version, symbol.mode);
+    CHECK(9 == QR::capacity(1, LEVEL_L, KANJI, UTF_8) && 10 == QR::capacity(1, LEVEL_L, KANJI), "UTF-8 kanji capacity %d",
+          QR::capacity(1, LEVEL_L, KANJI, UTF_8));
+    CHECK(1 == QR::encode(shift_jis, LEVEL_L).version, "Shift JIS version %d", QR::encode(shift_jis, LEVEL_L).version);
+}
+
+static unsigned long crc32_bitwise(const unsigned char *buf, size_t len)
+{
+    unsigned long crc = 0xFFFFFFFF;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        crc ^= buf[i];
+
+        for (int k = 0; k < 8; k++)
+        {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+        }
+    }
+
+    return crc ^ 0xFFFFFFFF;
+}
+
+/* Pseudo-random bytes, 16 more than the longest length checked for unaligned starts */
+static void checksum_data(vector<unsigned char> &data)
+{
+    data.resize(300007 + 16);
+
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        data[i] = (unsigned char)(i*2654435761u >> 13);
+    }
+}
+
+/* Check value, then lengths around the 8-byte and 64-byte blocks of the fast paths, with unaligned starts and tails */
+void check_crc32()
+{
+    unsigned char digits[] = "123456789";
+    size_t lengths[] = {1, 3, 7, 8, 9, 15, 16, 17, 63, 64, 65, 127, 128, 129, 255, 1000, 5553, 65537, 300007};
+    vector<unsigned char> data;
+
+    CHECK(0xCBF43926 == CRC32(digits, 9), "CRC32 check value %08lx", CRC32(digits, 9));
+    CHECK(0 == CRC32(digits, 0), "CRC32 of nothing %08lx", CRC32(digits, 0));
+
+    checksum_data(data);
+
+    for (int n = 0; n < (int)(sizeof(lengths)/sizeof(lengths[0])); n++)
+    {
+        for (int offset = 0; offset < 16; offset += (lengths[n] > 5553) ? 5 : 1)
+        {
+            const unsigned char *p = &data[offset];
+            size_t len = lengths[n];
+            size_t half = len/3 + offset;
+
+            CHECK(crc32_bitwise(p, len) == CRC32((void *)p, (long)len), "CRC32 length %d offset %d", (int)len, offset);
+
+            /* Split in two at an odd place */
+            if (half < len)
+            {
+                CHECK(CRC32((void *)p, (long)len) == crc32_update(crc32_update(0, p, (long)half), p + half, (long)(len - half)),
+                      "CRC32 split length %d offset %d", (int)len, offset);
+            }
+        }
+    }
+}
+
+static unsigned long adler32_bytewise(unsigned long adler, const unsigned char *buf, size_t len)
+{
+    unsigned long a = adler & 0xFFFF;
+    unsigned long b = adler >> 16;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        a = (a + buf[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+
+    return (b << 16) | a;
+}
+
+/* Known values, then lengths past NMAX (5552) and unaligned starts and tails against the bytewise definition */
+void check_adler32()
+{
+    unsigned char digits[] = "123456789";
+    unsigned char wikipedia[] = "Wikipedia";
+    size_t lengths[] = {1, 3, 15, 16, 17, 31, 32, 33, 63, 64, 65, 127, 255, 1000, 5551, 5552, 5553, 11104, 11105, 65537, 300007};
+    vector<unsigned char> data;
+
+    CHECK(0x091E01DE == Adler32(digits, 9), "Adler32 check value %08lx", Adler32(digits, 9));
+    CHECK(0x11E60398 == Adler32(wikipedia, 9), "Adler32 Wikipedia %08lx", Adler32(wikipedia, 9));
+    CHECK(1 == Adler32(wikipedia, 0), "Adler32 of nothing %08lx", Adler32(wikipedia, 0));
+
+    checksum_data(data);
+
+    /* All 0xFF: the largest sums before the modulo */
+    vector<unsigned char> ones(data.size(), 0xFF);
+
+    for (int n = 0; n < (int)(sizeof(lengths)/sizeof(lengths[0])); n++)
+    {
+        for (int offset = 0; offset < 16; offset += (lengths[n] > 5553) ? 5 : 1)
+        {
+            const unsigned char *p = &data[offset];
+            size_t len = lengths[n];
+            size_t half = len/3 + offset;
+
+            CHECK(adler32_bytewise(1, p, len) == Adler32((unsigned char *)p, (int)len), "Adler32 length %d offset %d", (int)len, offset);
+
+            /* Sums of BASE - 1 to start with: the longest run without a modulo still fits in 32 bits */
+            CHECK(adler32_bytewise(0xFFF0FFF0, &ones[offset], len) == adler32_update(0xFFF0FFF0, &ones[offset], len),
+                  "Adler32 0xFF length %d offset %d", (int)len, offset);
+
+            /* Split in two at an odd place */
+            if (half < len)
+            {
+                CHECK(Adler32((unsigned char *)p, (int)len) == adler32_update(adler32_update(1, p, half), p + half, len - half),
+                      "Adler32 split length %d offset %d", (int)len, offset);
+            }
+        }
+    }
+}
+
+static void read_file(char *path, vector<unsigned char> &data)
+{
+    FILE *f = fopen(path, "rb");
+    int c = 0;
+
+    if (NULL == f)
+    {
+        return;
+    }
+
+    while (EOF != (c = fgetc(f)))
+    {
+        data.push_back((unsigned char)c);
+    }
+    fclose(f);
+}
+
+/* Test image size: rows are not a multiple of the SIMD widths */
+#define TEST_PNG_WIDTH           (67)
+#define TEST_PNG_HEIGHT          (29)
+
+/* Test image of every color type of the checks: 0 RGBA, 1 RGB, 2 2-bit indexed */
+static void test_png(PNG &png, int color, vector<PIXEL> &pixels, vector<unsigned char> &indexes)
+{
+    const unsigned long width = TEST_PNG_WIDTH;
+    const unsigned long height = TEST_PNG_HEIGHT;
+    PIXEL palette[] = {{0xFF, 0xFF, 0xFF, 0xFF}, {0, 0, 0, 0xFF}, {0xFF, 0, 0, 0xFF}, {0, 0, 0xFF, 0xFF}};
+
+    pixels.resize(width*height);
+    indexes.resize(width*height);
+
+    for (unsigned long i = 0; i < width*height; i++)
+    {
+        pixels[i].red = (unsigned char)(i*7);
+        pixels[i].green = (unsigned char)((i % width)*(i/width));
+        pixels[i].blue = (unsigned char)(i*2654435761u >> 24);
+        pixels[i].alpha = (unsigned char)(255 - i % 3);
+        indexes[i] = (unsigned char)(((i % width)/3 + (i/width)/2) % 4);
+    }
+
+    if (0 == color)
+    {
+        png.set_ihdr(width, height, BIT_DEPTH_8, ALPHA_TRUECOLOR);
+        png.set_idat(&pixels[0]);
+    }
+    else if (1 == color)
+    {
+        png.set_ihdr(width, height, BIT_DEPTH_8, TRUECOLOR);
+        png.set_idat(&pixels[0]);
+    }
+    else
+    {
+        png.set_ihdr(width, height, BIT_DEPTH_2, INDEXED_COLOR);
+        png.set_plte(palette, 4);
+        png.set_idat(&indexes[0]);
+    }
+}
+
+/* write, write_to (vector, appended, and sink) and begin / push_row / finish write the same bytes for every filter and level */
+void check_png_output()
+{
+    char path[] = "test_check.png";
+
+    for (int color = 0; color < 3; color++)
+    {
+        for (int filter = FILTER_NONE; filter <= FILTER_ADAPTIVE; filter++)
+        {
+            for (int level = 0; level <= 9; level++)
+            {
+                PNG png;
+                vector<PIXEL> pixels;
+                vector<unsigned char> indexes;
+
+                test_png(png, color, pixels, indexes);
+                png.set_filter((FILTER_TYPE)filter);
+                png.set_compression(level);
+                png.set_idat_size(1000);
+
+                vector<unsigned char> out;
+                vector<unsigned char> appended(3, 0xAA);
+                vector<unsigned char> sunk;
+                vector<unsigned char> file;
+                vector<unsigned char> streamed;
+                PNG_SINK to_sunk = [&sunk](const unsigned char *data, size_t len) { sunk.insert(sunk.end(), data, data + len); };
+                PNG_SINK to_streamed = [&streamed](const unsigned char *data, size_t len) { streamed.insert(streamed.end(), data, data + len); };
+
+                CHECK(png.write_to(out), "write_to color %d filter %d level %d", color, filter, level);
+                CHECK(png.write_to(appended), "write_to append color %d filter %d level %d", color, filter, level);
+                CHECK(png.write_to(to_sunk), "write_to sink color %d filter %d level %d", color, filter, level);
+                CHECK(png.write(path), "write color %d filter %d level %d", color, filter, level);
+                CHECK(out.size() <= png.size_bound(), "size_bound color %d filter %d level %d", color, filter, level);
+
+                /* One stream at a time, and nothing else is written while it is open */
+                CHECK(png.begin(to_streamed), "begin color %d filter %d level %d", color, filter, level);
+                CHECK(!png.begin(to_streamed) && !png.write_to(to_sunk), "second begin color %d filter %d level %d", color, filter, level);
+
+                for (unsigned long h = 0; h < TEST_PNG_HEIGHT; h++)
+                {
+                    if (2 == color)
+                    {
+                        png.push_row(&indexes[h*TEST_PNG_WIDTH]);
+                    }
+                    else
+                    {
+                        png.push_row(&pixels[h*TEST_PNG_WIDTH]);
+                    }
+                }
+                CHECK(png.finish(), "finish color %d filter %d level %d", color, filter, level);
+
+                read_file(path, file);
+                appended.erase(appended.begin(), appended.begin() + 3);
+
+                CHECK(!out.empty() && out == appended && out == sunk && out == file && out == streamed,
+                      "outputs differ color %d filter %d level %d: %d %d %d %d %d bytes", color, filter, level,
+                      (int)out.size(), (int)appended.size(), (int)sunk.size(), (int)file.size(), (int)streamed.size());
+            }
+        }
+    }
+
+    remove(path);
+}
+
+/* filter_cost: the SIMD sum equals the scalar one, for short rows and for a row whose cost passes 2^32 */
+void check_filter_cost()
+{
+    vector<unsigned char> row(100);
+
+    for (size_t len = 0; len < row.size(); len++)
+    {
+        unsigned long cost = 0;
+
+        for (size_t i = 0; i < len; i++)
+        {
+            row[i] = (unsigned char)(i*2654435761u >> 11);
+            cost += (row[i] < 128) ? row[i] : 256 - row[i];
+        }
+
+        CHECK(cost == filter_cost(&row[0], len), "filter_cost length %d", (int)len);
+    }
+
+    /* 0x80 costs 128: 40 MB of it is 5*2^30 */
+    vector<unsigned char> large(40 << 20, 0x80);
+    unsigned long expected = (unsigned long)(128ULL*large.size());
+
+    CHECK(expected == filter_cost(&large[0], large.size()), "filter_cost of 40 MB: %lu", filter_cost(&large[0], large.size()));
+}
+
+/* 1-bit indexed rows: packing 8 indexes at a time matches setting the bits one by one, for any width */
+void check_pack_1bpp()
+{
+    for (unsigned long width = 1; width <= 80; width++)
+    {
+        const unsigned long height = 5;
+        size_t packed_len = (width + 7)/8;
+        vector<unsigned char> indexes(width*height);
+        vector<unsigned char> packed(packed_len*height, 0);
+        PIXEL palette[] = {{0xFF, 0xFF, 0xFF, 0xFF}, {0, 0, 0, 0xFF}};
+
+        for (unsigned long i = 0; i < width*height; i++)
+        {
+            indexes[i] = (unsigned char)((i*2654435761u >> 7) & 1);
+
+            if (indexes[i])
+            {
+                packed[(i/width)*packed_len + (i % width)/8] |= 0x80 >> ((i % width) % 8);
+            }
+        }
+
+        PNG png;
+        vector<unsigned char> out;
+        vector<unsigned char> scanlines;
+        PNG_SINK sink = [&scanlines](const unsigned char *data, size_t len) { scanlines.insert(scanlines.end(), data, data + len); };
+
+        png.set_ihdr(width, height, BIT_DEPTH_1, INDEXED_COLOR);
+        png.set_plte(palette, 2);
+        png.set_idat(&indexes[0]);
+        png.write_to(out);
+
+        png.begin(sink);
+        for (unsigned long h = 0; h < height; h++)
+        {
+            png.push_scanline(&packed[h*packed_len]);
+        }
+        png.finish();
+
+        CHECK(!out.empty() && out == scanlines, "1-bit width %lu", width);
+    }
+}
+
 int main()
 {
+    check_penalty();
+    check_parallel_for();
+    check_mask_threads();
+    check_batch();
+    check_mixed_mode();
+    check_capacity();
+    check_crc32();
+    check_adler32();
+    check_png_output();
+    check_filter_cost();
+    check_pack_1bpp();
+
+    printf("%d checks failed\n", failures);
+
+    if (failures)
+    {
+        return 1;
+    }
+
     for (int v = 1; v <= 40; v++)
     {
         for (int e = LEVEL_L; e <= LEVEL_H; e++)